@@ -0,0 +1,255 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "hm_bench.h"
+
+static int hm_bench_nop()
+{
+	return 0;
+}
+
+static const hm_bench_alloc hm_bench_allocs[] = {
+	{ "hotmem", hm_malloc, hm_free, hm_task_register, hm_task_unregister },
+	{ "libc", malloc, free, hm_bench_nop, hm_bench_nop },
+};
+
+static const struct {
+	const char* name;
+	void (*fn)();
+} hm_bench_cases[] = {
+	{ "latency", hm_bench_latency },
+	{ "scaling", hm_bench_scaling },
+	{ "prodcons", hm_bench_prodcons },
+	{ "churn", hm_bench_churn },
+	{ "larson", hm_bench_larson },
+	{ "xmalloc", hm_bench_xmalloc },
+	{ "frag", hm_bench_frag },
+	{ "classes", hm_bench_classes },
+	{ "shm", hm_bench_shm },
+	{ "prefault", hm_bench_prefault },
+	{ "numa", hm_bench_numa },
+	{ "ebr", hm_bench_ebr },
+	{ "ctx", hm_bench_ctx },
+	{ "guard", hm_bench_guard },
+	{ "budget", hm_bench_budget },
+	{ "snap", hm_bench_snap },
+	{ "large", hm_bench_large },
+};
+
+hm_bench_opts hm_bench;
+
+uint64_t hm_bench_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ull+(uint64_t)ts.tv_nsec;
+}
+
+size_t hm_bench_rss()
+{
+	unsigned long size, resident;
+	FILE* fp;
+
+	fp = fopen("/proc/self/statm", "r");
+	if(!fp)
+		return 0;
+	if(fscanf(fp, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+	fclose(fp);
+
+	return (size_t)resident*(size_t)sysconf(_SC_PAGESIZE);
+}
+
+uint64_t hm_bench_iters(uint64_t full)
+{
+	return hm_bench.quick ? full/20+1 : full;
+}
+
+typedef struct hm_bench_thread_s {
+	hm_bench_fn fn;
+	void* arg;
+}hm_bench_thread;
+
+static void* hm_bench_entry(void* arg)
+{
+	hm_bench_thread* thread = arg;
+	void* ret;
+
+	hm_bench.alloc->attach();
+	ret = thread->fn(thread->arg);
+	hm_bench.alloc->detach();
+	return ret;
+}
+
+void hm_bench_run(int threads, hm_bench_fn fn, void* args, size_t size)
+{
+	hm_bench_thread* slots;
+	pthread_t* ids;
+	int index;
+
+	slots = calloc((size_t)threads, sizeof(hm_bench_thread));
+	ids = calloc((size_t)threads, sizeof(pthread_t));
+	if(!slots || !ids)
+		abort();
+
+	for(index = 0; index < threads; index ++) {
+		slots[index].fn = fn;
+		slots[index].arg = (char* )args+(size_t)index*size;
+		if(pthread_create(&ids[index], NULL, hm_bench_entry, &slots[index]))
+			abort();
+	}
+	for(index = 0; index < threads; index ++)
+		pthread_join(ids[index], NULL);
+
+	free(ids);
+	free(slots);
+}
+
+void hm_bench_begin(const char* name)
+{
+	fprintf(hm_bench.out, "{\"bench\":\"%s\",\"alloc\":\"%s\"", name, hm_bench.alloc->name);
+}
+
+void hm_bench_u64(const char* key, uint64_t value)
+{
+	fprintf(hm_bench.out, ",\"%s\":%llu", key, (unsigned long long)value);
+}
+
+void hm_bench_f64(const char* key, double value)
+{
+	fprintf(hm_bench.out, ",\"%s\":%.3f", key, value);
+}
+
+void hm_bench_str(const char* key, const char* value)
+{
+	fprintf(hm_bench.out, ",\"%s\":\"%s\"", key, value);
+}
+
+void hm_bench_end()
+{
+	fprintf(hm_bench.out, "}\n");
+	fflush(hm_bench.out);
+}
+
+static void hm_bench_usage(const char* prog)
+{
+	size_t index;
+
+	fprintf(stderr, "usage: %s [--quick] [--threads N] [--alloc hotmem|libc] [--output FILE] [--profile FILE] [case...]\n", prog);
+	fprintf(stderr, "cases:");
+	for(index = 0; index < array_size(hm_bench_cases); index ++)
+		fprintf(stderr, " %s", hm_bench_cases[index].name);
+	fprintf(stderr, "\n");
+}
+
+static int hm_bench_selected(int argc, char** argv, int first, const char* name)
+{
+	int index;
+
+	if(first >= argc)
+		return 1;
+	for(index = first; index < argc; index ++) {
+		if(!strcmp(argv[index], name))
+			return 1;
+	}
+	return 0;
+}
+
+/* allocates before main() and before anyone called hm_initialize() */
+static int hm_bench_early;
+
+__attribute__((constructor)) static void hm_bench_construct()
+{
+	char* ptr = hm_malloc(64);
+
+	if(ptr) {
+		memset(ptr, 0, 64);
+		hm_free(ptr);
+		hm_bench_early = 1;
+	}
+}
+
+static int hm_bench_known(const char* name)
+{
+	size_t index;
+
+	for(index = 0; index < array_size(hm_bench_cases); index ++) {
+		if(!strcmp(hm_bench_cases[index].name, name))
+			return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	size_t index;
+	int arg, first;
+
+	hm_bench.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if(hm_bench.threads < 2)
+		hm_bench.threads = 2;
+	hm_bench.alloc = &hm_bench_allocs[0];
+	hm_bench.out = stdout;
+
+	for(arg = 1; arg < argc && argv[arg][0] == '-'; arg ++) {
+		if(!strcmp(argv[arg], "--quick"))
+			hm_bench.quick = 1;
+		else if(!strcmp(argv[arg], "--threads") && arg+1 < argc)
+			hm_bench.threads = atoi(argv[++ arg]);
+		else if(!strcmp(argv[arg], "--alloc") && arg+1 < argc) {
+			arg ++;
+			for(index = 0; index < array_size(hm_bench_allocs); index ++) {
+				if(!strcmp(argv[arg], hm_bench_allocs[index].name))
+					break;
+			}
+			if(index == array_size(hm_bench_allocs)) {
+				hm_bench_usage(argv[0]);
+				return 2;
+			}
+			hm_bench.alloc = &hm_bench_allocs[index];
+		}
+		else if(!strcmp(argv[arg], "--profile") && arg+1 < argc)
+			hm_bench.profile = argv[++ arg];
+		else if(!strcmp(argv[arg], "--output") && arg+1 < argc) {
+			hm_bench.out = fopen(argv[++ arg], "w");
+			if(!hm_bench.out) {
+				perror(argv[arg]);
+				return 1;
+			}
+		}
+		else {
+			hm_bench_usage(argv[0]);
+			return 2;
+		}
+	}
+	first = arg;
+	if(hm_bench.threads < 1)
+		hm_bench.threads = 1;
+
+	for(; arg < argc; arg ++) {
+		if(!hm_bench_known(argv[arg])) {
+			hm_bench_usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if(!hm_bench_early) {
+		fprintf(stderr, "allocation before main failed\n");
+		return 1;
+	}
+
+	hm_bench.alloc->attach();
+	for(index = 0; index < array_size(hm_bench_cases); index ++) {
+		if(hm_bench_selected(argc, argv, first, hm_bench_cases[index].name))
+			hm_bench_cases[index].fn();
+	}
+	hm_bench.alloc->detach();
+
+	if(hm_bench.out != stdout)
+		fclose(hm_bench.out);
+	return 0;
+}
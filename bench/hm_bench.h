@@ -0,0 +1,78 @@
+#ifndef HM_BENCH_H
+#define HM_BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hotmem.h"
+
+/* allocator under test, hotmem or the system heap for a baseline */
+typedef struct hm_bench_alloc_s {
+	const char* name;
+	void* (*alloc)(size_t size);
+	void (*free)(void* ptr);
+	int (*attach)();
+	int (*detach)();
+}hm_bench_alloc;
+
+typedef struct hm_bench_opts_s {
+	int quick;
+	int threads;
+	const hm_bench_alloc* alloc;
+	FILE* out;
+	/* where the classes case writes its size histogram */
+	const char* profile;
+}hm_bench_opts;
+
+extern hm_bench_opts hm_bench;
+
+typedef void* (*hm_bench_fn)(void* arg);
+
+uint64_t hm_bench_now();
+size_t hm_bench_rss();
+uint64_t hm_bench_iters(uint64_t full);
+
+static __inline uint64_t hm_bench_rand(uint64_t* state)
+{
+	uint64_t x = *state;
+
+	x ^= x<<13;
+	x ^= x>>7;
+	x ^= x<<17;
+	return *state = x;
+}
+
+static __inline size_t hm_bench_size(uint64_t* state, size_t min, size_t max)
+{
+	return min+(size_t)(hm_bench_rand(state)%(max-min+1));
+}
+
+/* run fn on threads threads, each with its own slot of args, attached to the allocator */
+void hm_bench_run(int threads, hm_bench_fn fn, void* args, size_t size);
+
+/* one JSON object per line */
+void hm_bench_begin(const char* name);
+void hm_bench_u64(const char* key, uint64_t value);
+void hm_bench_f64(const char* key, double value);
+void hm_bench_str(const char* key, const char* value);
+void hm_bench_end();
+
+void hm_bench_latency();
+void hm_bench_scaling();
+void hm_bench_prodcons();
+void hm_bench_churn();
+void hm_bench_larson();
+void hm_bench_xmalloc();
+void hm_bench_frag();
+void hm_bench_classes();
+void hm_bench_shm();
+void hm_bench_prefault();
+void hm_bench_numa();
+void hm_bench_ebr();
+void hm_bench_ctx();
+void hm_bench_guard();
+void hm_bench_budget();
+void hm_bench_snap();
+void hm_bench_large();
+
+#endif
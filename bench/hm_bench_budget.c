@@ -0,0 +1,206 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "hm_bench.h"
+
+#define HM_BENCH_BUDGET_BLOCK 1024
+#define HM_BENCH_BUDGET_MAX (64u<<20)
+/* the group's limits for all threads, the task limit of the first one */
+#define HM_BENCH_BUDGET_SOFT (8u<<20)
+#define HM_BENCH_BUDGET_HARD (16u<<20)
+#define HM_BENCH_BUDGET_TASK (2u<<20)
+/* the soft limit of a context refilling on its own */
+#define HM_BENCH_BUDGET_CTX (256u<<10)
+
+typedef struct hm_bench_tenant_s {
+	hm_group* group;
+	int index;
+	int threads;
+	uint64_t held;
+	uint64_t events;
+	int large;
+}hm_bench_tenant;
+
+static uint64_t hm_bench_budget_events[2];
+/* tenants refused so far, all of them hold their blocks until the last one is */
+static int hm_bench_budget_full;
+
+static void hm_bench_budget_hit(hm_group* group, u32 events, s64 usage, void* arg)
+{
+	(void)usage;
+	(void)arg;
+	__atomic_or_fetch(&hm_bench_budget_events[group != NULL], (uint64_t)events, __ATOMIC_RELAXED);
+}
+
+/* a runaway tenant, it keeps everything until the allocator says no */
+static void* hm_bench_budget_worker(void* arg)
+{
+	hm_bench_tenant* tenant = arg;
+	void** blocks;
+	void* large;
+	size_t count, n;
+
+	count = HM_BENCH_BUDGET_MAX/HM_BENCH_BUDGET_BLOCK;
+	blocks = calloc(count, sizeof(void* ));
+	if(!blocks || hm_task_set_group(tenant->group))
+		abort();
+	if(!tenant->index &&
+		hm_task_set_budget(HM_BENCH_BUDGET_TASK/2, HM_BENCH_BUDGET_TASK, hm_bench_budget_hit, NULL))
+		abort();
+
+	for(n = 0; n < count; n ++) {
+		blocks[n] = hm_malloc(HM_BENCH_BUDGET_BLOCK);
+		if(!blocks[n])
+			break;
+		memset(blocks[n], 0, HM_BENCH_BUDGET_BLOCK);
+	}
+	tenant->held = (uint64_t)n*HM_BENCH_BUDGET_BLOCK;
+
+	/* large blocks are held to the same limits */
+	large = hm_malloc(HM_BENCH_BUDGET_HARD);
+	tenant->large = large != NULL;
+	hm_free(large);
+
+	__atomic_add_fetch(&hm_bench_budget_full, 1, __ATOMIC_RELAXED);
+	while(__atomic_load_n(&hm_bench_budget_full, __ATOMIC_RELAXED) < tenant->threads)
+		sched_yield();
+
+	while(n --)
+		hm_free(blocks[n]);
+	free(blocks);
+	return NULL;
+}
+
+/*
+ * a context whose task sits on another node refills from the manager
+ * itself. crossing a soft limit drains it in the middle of the refill.
+ */
+static void* hm_bench_budget_ctx_worker(void* arg)
+{
+	uint64_t* events = arg;
+	hm_task* task = hm_task_self();
+	void* blocks[2048];
+	hm_ctx* ctx;
+	u32 node;
+	size_t n, size;
+
+	hm_bench_budget_events[0] = 0;
+	ctx = hm_ctx_create();
+	if(!task || !ctx || hm_task_set_budget(HM_BENCH_BUDGET_CTX, 0, hm_bench_budget_hit, NULL))
+		abort();
+
+	/* nothing allocates from the task cache meanwhile, its node may be made up */
+	node = task->mem.node;
+	task->mem.node = ctx->mem.node+1;
+	hm_ctx_switch(ctx);
+	for(n = 0; n < array_size(blocks); n ++) {
+		size = (size_t)16<<(n%8);
+		blocks[n] = hm_malloc(size);
+		if(!blocks[n])
+			abort();
+		memset(blocks[n], (int)n, size);
+	}
+	for(n = 0; n < array_size(blocks); n ++) {
+		if(*(unsigned char* )blocks[n] != (unsigned char)n)
+			abort();
+		hm_free(blocks[n]);
+	}
+	hm_ctx_destroy(ctx);
+	task->mem.node = node;
+
+	*events = hm_bench_budget_events[0];
+	hm_bench_budget_events[0] = 0;
+	return NULL;
+}
+
+/* a producer in a group, what it hands out outlives it */
+static void* hm_bench_budget_producer(void* arg)
+{
+	void** blocks = arg;
+	size_t n;
+
+	for(n = 1; n < HM_BENCH_BUDGET_BLOCK; n ++) {
+		blocks[n] = hm_malloc(HM_BENCH_BUDGET_BLOCK);
+		if(!blocks[n])
+			abort();
+	}
+	if(hm_task_set_group(blocks[0]))
+		abort();
+	return NULL;
+}
+
+/* tenants sharing a group stay under its hard limit, the rest of the process does not care */
+void hm_bench_budget()
+{
+	hm_bench_tenant* tenants;
+	hm_group* group;
+	uint64_t held, events;
+	void** blocks;
+	s64 left;
+	int threads, index;
+	void* ptr;
+
+	if(hm_bench.alloc->alloc != hm_malloc)
+		return;
+
+	group = hm_group_create(HM_BENCH_BUDGET_SOFT, HM_BENCH_BUDGET_HARD, hm_bench_budget_hit, NULL);
+	threads = hm_bench.threads < 2 ? 2 : hm_bench.threads;
+	tenants = calloc((size_t)threads, sizeof(hm_bench_tenant));
+	if(!group || !tenants)
+		abort();
+	for(index = 0; index < threads; index ++) {
+		tenants[index].group = group;
+		tenants[index].index = index;
+		tenants[index].threads = threads;
+	}
+
+	hm_bench_run(1, hm_bench_budget_ctx_worker, &events, sizeof(events));
+	if(events != HM_BUDGET_SOFT)
+		abort();
+
+	/* a task that exits takes what it holds out of its group */
+	blocks = calloc(HM_BENCH_BUDGET_BLOCK, sizeof(void* ));
+	if(!blocks || !(blocks[0] = hm_group_create(0, 0, NULL, NULL)))
+		abort();
+	hm_bench_run(1, hm_bench_budget_producer, blocks, sizeof(void* ));
+	if(hm_group_usage(blocks[0]))
+		abort();
+	hm_group_destroy(blocks[0]);
+	for(index = 1; index < HM_BENCH_BUDGET_BLOCK; index ++)
+		hm_free(blocks[index]);
+	free(blocks);
+
+	hm_bench_run(threads, hm_bench_budget_worker, tenants, sizeof(hm_bench_tenant));
+
+	held = 0;
+	for(index = 0; index < threads; index ++)
+		held += tenants[index].held;
+	/* everything came back when the tenants exited */
+	left = hm_group_usage(group);
+	ptr = hm_malloc(HM_BENCH_BUDGET_MAX);
+	hm_free(ptr);
+
+	hm_bench_begin("budget");
+	hm_bench_u64("threads", (uint64_t)threads);
+	hm_bench_u64("hard", HM_BENCH_BUDGET_HARD);
+	hm_bench_u64("held", held);
+	hm_bench_u64("task_held", tenants[0].held);
+	hm_bench_u64("task_events", hm_bench_budget_events[0]);
+	hm_bench_u64("group_events", hm_bench_budget_events[1]);
+	hm_bench_u64("left", (uint64_t)left);
+	hm_bench_u64("ctx_events", events);
+	hm_bench_end();
+
+	if(held > HM_BENCH_BUDGET_HARD || tenants[0].held > HM_BENCH_BUDGET_TASK ||
+		hm_bench_budget_events[0] != (HM_BUDGET_SOFT|HM_BUDGET_HARD) ||
+		hm_bench_budget_events[1] != (HM_BUDGET_SOFT|HM_BUDGET_HARD) || left || !ptr)
+		abort();
+	for(index = 0; index < threads; index ++) {
+		if(tenants[index].large || !tenants[index].held)
+			abort();
+	}
+
+	free(tenants);
+	hm_group_destroy(group);
+}
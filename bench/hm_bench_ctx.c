@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "hm_bench.h"
+
+#define HM_BENCH_LIVE 4
+#define HM_BENCH_STEPS 4
+
+typedef struct hm_bench_fiber_s {
+	hm_ctx* ctx;
+	void* live[HM_BENCH_LIVE];
+}hm_bench_fiber;
+
+typedef struct hm_bench_sched_s {
+	hm_bench_fiber* fibers;
+	uint64_t count;
+	uint64_t rounds;
+	int contexts;
+	uint64_t switch_ns;
+	uint64_t nsec;
+	uint64_t ops;
+	double pages;
+}hm_bench_sched;
+
+/* distinct pages under the live blocks of a fiber, averaged */
+static double hm_bench_ctx_pages(hm_bench_sched* sched)
+{
+	uintptr_t pages[HM_BENCH_LIVE];
+	uint64_t i, total;
+	int j, k, n;
+
+	total = 0;
+	for(i = 0; i < sched->count; i ++) {
+		n = 0;
+		for(j = 0; j < HM_BENCH_LIVE; j ++) {
+			pages[n] = (uintptr_t)sched->fibers[i].live[j]>>12;
+			for(k = 0; k < n && pages[k] != pages[n]; k ++)
+				;
+			n += k == n;
+		}
+		total += (uint64_t)n;
+	}
+	return (double)total/(double)sched->count;
+}
+
+/* one scheduler thread running its fibers round robin */
+static void* hm_bench_ctx_worker(void* arg)
+{
+	hm_bench_sched* sched = arg;
+	hm_bench_fiber* fiber;
+	hm_stats before, after;
+	uint64_t rand, i, r, start;
+	void *ptr, *again;
+	int j, step;
+
+	hm_mgr_stats(&hm_mgr_main, &before);
+	rand = 0x9e3779b97f4a7c15ull;
+	for(i = 0; i < sched->count; i ++) {
+		fiber = &sched->fibers[i];
+		if(sched->contexts) {
+			fiber->ctx = hm_ctx_create();
+			if(!fiber->ctx)
+				abort();
+			hm_ctx_switch(fiber->ctx);
+		}
+		for(j = 0; j < HM_BENCH_LIVE; j ++)
+			fiber->live[j] = hm_malloc(hm_bench_size(&rand, 16, 256));
+	}
+
+	start = hm_bench_now();
+	for(r = 0; r < sched->rounds; r ++) {
+		for(i = 0; i < sched->count; i ++) {
+			fiber = &sched->fibers[i];
+			if(sched->contexts)
+				hm_ctx_switch(fiber->ctx);
+			for(step = 0; step < HM_BENCH_STEPS; step ++) {
+				j = (int)(hm_bench_rand(&rand)%HM_BENCH_LIVE);
+				hm_free(fiber->live[j]);
+				fiber->live[j] = hm_malloc(hm_bench_size(&rand, 16, 256));
+			}
+		}
+	}
+	sched->nsec = hm_bench_now()-start;
+	sched->ops = sched->rounds*sched->count*HM_BENCH_STEPS;
+	sched->pages = hm_bench_ctx_pages(sched);
+
+	if(sched->contexts) {
+		start = hm_bench_now();
+		for(r = 0; r < sched->rounds*sched->count; r ++)
+			hm_ctx_switch(sched->fibers[r%sched->count].ctx);
+		sched->switch_ns = (hm_bench_now()-start)/(r ? r : 1);
+
+		/* a context hands back its own last freed block */
+		ptr = hm_malloc(64);
+		hm_free(ptr);
+		again = hm_malloc(64);
+		if(again != ptr)
+			abort();
+		hm_free(again);
+	}
+
+	for(i = 0; i < sched->count; i ++) {
+		fiber = &sched->fibers[i];
+		if(sched->contexts)
+			hm_ctx_switch(fiber->ctx);
+		for(j = 0; j < HM_BENCH_LIVE; j ++)
+			hm_free(fiber->live[j]);
+		if(sched->contexts)
+			hm_ctx_destroy(fiber->ctx);
+	}
+	if(hm_ctx_current())
+		abort();
+
+	/* destroyed contexts keep nothing beyond what went to the thread's cache */
+	hm_mem_release(&hm_task_self()->mem);
+	hm_mgr_stats(&hm_mgr_main, &after);
+	if(sched->contexts && after.spans != before.spans)
+		abort();
+	return NULL;
+}
+
+/* many fibers on one thread, sharing its cache or each with a context */
+void hm_bench_ctx()
+{
+	hm_bench_sched sched;
+	int contexts;
+
+	if(hm_bench.alloc->alloc != hm_malloc)
+		return;
+
+	for(contexts = 0; contexts < 2; contexts ++) {
+		memset(&sched, 0, sizeof(sched));
+		sched.count = hm_bench_iters(20000);
+		sched.rounds = 20;
+		sched.contexts = contexts;
+		sched.fibers = calloc(sched.count, sizeof(hm_bench_fiber));
+		if(!sched.fibers)
+			abort();
+
+		hm_bench_run(1, hm_bench_ctx_worker, &sched, sizeof(sched));
+
+		hm_bench_begin("ctx");
+		hm_bench_str("mode", contexts ? "context" : "shared");
+		hm_bench_u64("fibers", sched.count);
+		hm_bench_f64("ops_per_sec", (double)sched.ops*1e9/(double)(sched.nsec ? sched.nsec : 1));
+		hm_bench_f64("pages_per_fiber", sched.pages);
+		if(contexts) {
+			hm_bench_u64("switch_ns", sched.switch_ns);
+			/* an idle context is the struct, one that holds blocks adds its bins */
+			hm_bench_u64("ctx_bytes", sizeof(hm_ctx));
+			hm_bench_u64("bin_bytes", hm_pool_classes*sizeof(hm_bin));
+		}
+		hm_bench_end();
+
+		free(sched.fibers);
+	}
+}
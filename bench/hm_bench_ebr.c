@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "hm_bench.h"
+
+#define HM_BENCH_EBR_SLOTS 64
+#define HM_BENCH_EBR_MAGIC 0x6562726e6f646531ull
+
+typedef struct hm_bench_node_s {
+	uint64_t magic;
+	uint64_t seq;
+}hm_bench_node;
+
+typedef struct hm_bench_table_s {
+	hm_bench_node* slots[HM_BENCH_EBR_SLOTS];
+	uint64_t count;
+	int readers;
+	int ready;
+	int stop;
+}hm_bench_table;
+
+typedef struct hm_bench_reader_s {
+	hm_bench_table* table;
+	uint64_t rand;
+	uint64_t ops;
+	uint64_t nsec;
+	int index;
+}hm_bench_reader;
+
+static hm_bench_node* hm_bench_node_new(uint64_t seq)
+{
+	hm_bench_node* node = hm_malloc(sizeof(hm_bench_node));
+
+	if(!node)
+		abort();
+	node->magic = HM_BENCH_EBR_MAGIC;
+	node->seq = seq;
+	return node;
+}
+
+/* readers check that no node is freed under them, the writer swaps and retires */
+static void* hm_bench_ebr_worker(void* arg)
+{
+	hm_bench_reader* reader = arg;
+	hm_bench_table* table = reader->table;
+	hm_bench_node *node, *old;
+	uint64_t i, start;
+	size_t left;
+
+	if(reader->index) {
+		__atomic_add_fetch(&table->ready, 1, __ATOMIC_RELEASE);
+		start = hm_bench_now();
+		while(!__atomic_load_n(&table->stop, __ATOMIC_ACQUIRE)) {
+			hm_ebr_enter();
+			node = __atomic_load_n(&table->slots[hm_bench_rand(&reader->rand)%HM_BENCH_EBR_SLOTS],
+				__ATOMIC_ACQUIRE);
+			if(node->magic != HM_BENCH_EBR_MAGIC)
+				abort();
+			hm_ebr_exit();
+			reader->ops ++;
+		}
+		reader->nsec = hm_bench_now()-start;
+		return NULL;
+	}
+
+	while(__atomic_load_n(&table->ready, __ATOMIC_ACQUIRE) < table->readers)
+		sched_yield();
+
+	start = hm_bench_now();
+	for(i = 0; i < table->count; i ++) {
+		node = hm_bench_node_new(i);
+		old = __atomic_exchange_n(&table->slots[i%HM_BENCH_EBR_SLOTS], node, __ATOMIC_ACQ_REL);
+		hm_free_deferred(old);
+		/* lets the readers in on machines with fewer cpus than threads */
+		if(!(i&1023))
+			sched_yield();
+	}
+	reader->nsec = hm_bench_now()-start;
+	reader->ops = table->count;
+	__atomic_store_n(&table->stop, 1, __ATOMIC_RELEASE);
+
+	/* the readers are quiescent from here on, two advances free everything */
+	for(i = 0; (left = hm_ebr_reclaim()); i ++) {
+		if(i == 1000)
+			abort();
+		sched_yield();
+	}
+	return NULL;
+}
+
+void hm_bench_ebr()
+{
+	hm_bench_reader* readers;
+	hm_bench_table table;
+	uint64_t reads, nsec;
+	int threads, index;
+
+	if(hm_bench.alloc->alloc != hm_malloc)
+		return;
+
+	threads = hm_bench.threads < 2 ? 2 : hm_bench.threads;
+	memset(&table, 0, sizeof(table));
+	table.count = hm_bench_iters(1000000);
+	table.readers = threads-1;
+	for(index = 0; index < HM_BENCH_EBR_SLOTS; index ++)
+		table.slots[index] = hm_bench_node_new(0);
+
+	readers = calloc((size_t)threads, sizeof(hm_bench_reader));
+	if(!readers)
+		abort();
+	for(index = 0; index < threads; index ++) {
+		readers[index].table = &table;
+		readers[index].rand = 0x2545f4914f6cdd1dull*(uint64_t)(index+1);
+		readers[index].index = index;
+	}
+	hm_bench_run(threads, hm_bench_ebr_worker, readers, sizeof(hm_bench_reader));
+
+	reads = nsec = 0;
+	for(index = 1; index < threads; index ++) {
+		reads += readers[index].ops;
+		if(readers[index].nsec > nsec)
+			nsec = readers[index].nsec;
+	}
+
+	hm_bench_begin("ebr");
+	hm_bench_u64("readers", (uint64_t)threads-1);
+	hm_bench_u64("retired", table.count);
+	hm_bench_f64("retire_per_sec", (double)table.count*1e9/(double)(readers[0].nsec ? readers[0].nsec : 1));
+	hm_bench_f64("read_per_sec", (double)reads*1e9/(double)(nsec ? nsec : 1));
+	hm_bench_end();
+
+	for(index = 0; index < HM_BENCH_EBR_SLOTS; index ++)
+		hm_free(table.slots[index]);
+	free(readers);
+}
@@ -0,0 +1,141 @@
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "hm_bench.h"
+
+#define HM_BENCH_GUARD_SIZE 100
+#define HM_BENCH_GUARD_RATE 1000
+
+/* allocation and free of one size back to back, the sampled ones included */
+static double hm_bench_guard_pair(uint64_t iters)
+{
+	uint64_t i, start;
+	void* ptr;
+
+	start = hm_bench_now();
+	for(i = 0; i < iters; i ++) {
+		ptr = hm_malloc(64);
+		__asm__ __volatile__("" : : "r"(ptr) : "memory");
+		hm_free(ptr);
+	}
+	return (double)(hm_bench_now()-start)/(double)iters;
+}
+
+/* a block that landed on a guard page, sampling every allocation */
+static char* hm_bench_guarded(size_t size)
+{
+	char* ptr;
+	int n;
+
+	for(n = 0; n < 64; n ++) {
+		ptr = hm_malloc(size);
+		if(hm_chunk_of(ptr)->kind == HM_CHUNK_GUARD)
+			return ptr;
+		hm_free(ptr);
+	}
+	abort();
+}
+
+static void hm_bench_guard_bug(const char* bug)
+{
+	volatile char* ptr;
+
+	if(hm_guard_enable(1, 16))
+		_exit(3);
+	ptr = hm_bench_guarded(HM_BENCH_GUARD_SIZE);
+	ptr[0] = 1;
+
+	if(!strcmp(bug, "use-after-free")) {
+		hm_free((void* )ptr);
+		ptr[HM_BENCH_GUARD_SIZE/2] = 1;
+	}
+	else if(!strcmp(bug, "buffer-overflow"))
+		ptr[hm_usable_size((void* )ptr)] = 1;
+	else if(!strcmp(bug, "double-free")) {
+		hm_free((void* )ptr);
+		hm_free((void* )ptr);
+	}
+	_exit(0);
+}
+
+/* run the bug in a child, its report has to name it and carry both stacks */
+static void hm_bench_guard_catch(const char* bug, int sig)
+{
+	char report[16384];
+	int fds[2], status, found, stacks;
+	size_t size;
+	ssize_t n;
+	pid_t pid;
+
+	if(pipe(fds))
+		abort();
+	fflush(hm_bench.out);
+	pid = fork();
+	if(pid < 0)
+		abort();
+	if(!pid) {
+		close(fds[0]);
+		dup2(fds[1], 2);
+		hm_bench_guard_bug(bug);
+	}
+	close(fds[1]);
+
+	size = 0;
+	while(size < sizeof(report)-1 && (n = read(fds[0], report+size, sizeof(report)-1-size)) > 0)
+		size += (size_t)n;
+	report[size] = 0;
+	close(fds[0]);
+	if(waitpid(pid, &status, 0) != pid)
+		abort();
+
+	found = strstr(report, bug) != NULL;
+	stacks = strstr(report, "allocated by thread") && (strcmp(bug, "buffer-overflow") ?
+		strstr(report, "freed by thread") != NULL : 1);
+
+	hm_bench_begin("guard");
+	hm_bench_str("bug", bug);
+	hm_bench_u64("reported", (uint64_t)found);
+	hm_bench_u64("stacks", (uint64_t)stacks);
+	hm_bench_u64("signal", WIFSIGNALED(status) ? (uint64_t)WTERMSIG(status) : 0);
+	hm_bench_end();
+
+	if(!found || !stacks || !WIFSIGNALED(status) || WTERMSIG(status) != sig) {
+		fprintf(stderr, "%s", report);
+		abort();
+	}
+}
+
+/* what sampling costs the allocations it skips, then the reports */
+void hm_bench_guard()
+{
+	double off, on;
+	hm_guard_info info;
+	uint64_t iters;
+
+	if(hm_bench.alloc->alloc != hm_malloc)
+		return;
+
+	hm_bench_guard_catch("use-after-free", SIGSEGV);
+	hm_bench_guard_catch("buffer-overflow", SIGSEGV);
+	hm_bench_guard_catch("double-free", SIGABRT);
+
+	iters = hm_bench_iters(20000000);
+	off = hm_bench_guard_pair(iters);
+	if(hm_guard_enable(HM_BENCH_GUARD_RATE, 0))
+		abort();
+	on = hm_bench_guard_pair(iters);
+	hm_guard_disable();
+	hm_guard_stats(&info);
+
+	hm_bench_begin("guard");
+	hm_bench_u64("rate", HM_BENCH_GUARD_RATE);
+	hm_bench_f64("pair_ns_off", off);
+	hm_bench_f64("pair_ns_on", on);
+	hm_bench_u64("sampled", info.sampled);
+	hm_bench_u64("slots", info.slots);
+	hm_bench_u64("full", info.full);
+	hm_bench_end();
+}
@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "hm_bench.h"
+
+/* buffers of an i/o stack, log uniform from 128 KiB to 64 MiB */
+#define HM_BENCH_LARGE_MIN 17
+#define HM_BENCH_LARGE_MAX 26
+#define HM_BENCH_LARGE_LIVE 8
+
+static size_t hm_bench_large_size(uint64_t* rand)
+{
+	u32 shift = HM_BENCH_LARGE_MIN+(u32)(hm_bench_rand(rand)%(HM_BENCH_LARGE_MAX-HM_BENCH_LARGE_MIN));
+	size_t size = (size_t)1<<shift;
+
+	return size+(size_t)(hm_bench_rand(rand)%size);
+}
+
+static uint64_t hm_bench_large_calls(hm_stats* stats)
+{
+	return stats->mmaps+stats->munmaps+stats->madvises;
+}
+
+/* resident pages in [addr, addr+size) */
+static size_t hm_bench_large_resident(void* addr, size_t size)
+{
+	unsigned char vec[1024];
+	size_t pages, index, count = 0;
+
+	pages = size/HM_PAGE_SIZE;
+	if(pages > sizeof(vec) || mincore(addr, size, vec))
+		abort();
+	for(index = 0; index < pages; index ++)
+		count += vec[index]&1;
+	return count;
+}
+
+/* a cached mapping reused for a smaller block gives the pages past it back */
+static void hm_bench_large_tail()
+{
+	char *first, *again;
+	size_t size, tail;
+
+	size = (1u<<20)+(200u<<10);
+	first = hm_malloc(size);
+	memset(first, 1, size);
+	hm_free(first);
+
+	again = hm_malloc((1u<<20)+(16u<<10));
+	tail = hm_align_up((uintptr_t)again+hm_usable_size(again), HM_PAGE_SIZE)-(uintptr_t)again;
+
+	hm_bench_begin("large");
+	hm_bench_str("phase", "tail");
+	hm_bench_u64("reused", again == first);
+	hm_bench_u64("tail_resident", hm_bench_large_resident(again+tail, size-tail));
+	hm_bench_end();
+
+	if(again != first || hm_bench_large_resident(again+tail, size-tail))
+		abort();
+	hm_free(again);
+}
+
+/* a few live buffers at a time, replaced at random */
+void hm_bench_large()
+{
+	uint64_t rand = 0x9e3779b97f4a7c15ull;
+	void* live[HM_BENCH_LARGE_LIVE];
+	uint64_t iters, i, start, nsec;
+	hm_stats before, after;
+	size_t size;
+	int index;
+
+	iters = hm_bench_iters(20000);
+	memset(live, 0, sizeof(live));
+	hm_mgr_stats(&hm_mgr_main, &before);
+
+	start = hm_bench_now();
+	for(i = 0; i < iters; i ++) {
+		index = (int)(hm_bench_rand(&rand)%HM_BENCH_LARGE_LIVE);
+		hm_bench.alloc->free(live[index]);
+		size = hm_bench_large_size(&rand);
+		live[index] = hm_bench.alloc->alloc(size);
+		if(!live[index])
+			abort();
+		/* a buffer gets its first and last page written */
+		((char* )live[index])[0] = 1;
+		((char* )live[index])[size-1] = 1;
+	}
+	nsec = hm_bench_now()-start;
+
+	for(index = 0; index < HM_BENCH_LARGE_LIVE; index ++)
+		hm_bench.alloc->free(live[index]);
+	hm_mgr_stats(&hm_mgr_main, &after);
+
+	hm_bench_begin("large");
+	hm_bench_str("phase", "churn");
+	hm_bench_u64("iters", iters);
+	hm_bench_f64("pair_ns", (double)nsec/(double)iters);
+	if(hm_bench.alloc->alloc == hm_malloc) {
+		hm_bench_f64("syscalls_per_pair", (double)(hm_bench_large_calls(&after)-hm_bench_large_calls(&before))/(double)iters);
+		hm_bench_u64("mmaps", after.mmaps-before.mmaps);
+		hm_bench_u64("munmaps", after.munmaps-before.munmaps);
+		hm_bench_u64("madvises", after.madvises-before.madvises);
+		hm_bench_u64("cached", after.large_cached);
+		hm_bench_u64("cached_bytes", after.large_cached_bytes);
+	}
+	hm_bench_end();
+
+	if(hm_bench.alloc->alloc == hm_malloc)
+		hm_bench_large_tail();
+}
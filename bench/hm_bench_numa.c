@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+#include "hm_bench.h"
+
+#ifndef MPOL_F_ADDR
+#define MPOL_F_ADDR (1<<1)
+#endif
+
+#define HM_BENCH_NUMA_BLOCK 256
+#define HM_BENCH_NUMA_LARGE (1u<<20)
+
+typedef struct hm_bench_place_s {
+	int cpu;
+	u32 node;
+	uint64_t count;
+	void** ptrs;
+	void** frees;
+	uint64_t pages;
+	uint64_t local;
+	int policy;
+	unsigned long mask;
+}hm_bench_place;
+
+static void hm_bench_pin(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if(sched_setaffinity(0, sizeof(set), &set))
+		abort();
+}
+
+/* first cpu of every arena node, -1 for nodes without cpus */
+static void hm_bench_numa_cpus(int* cpus, u32 nodes)
+{
+	unsigned int cpu, node;
+	cpu_set_t saved;
+	u32 index;
+
+	for(index = 0; index < nodes; index ++)
+		cpus[index] = -1;
+
+	if(sched_getaffinity(0, sizeof(saved), &saved))
+		abort();
+	for(cpu = 0; cpu < CPU_SETSIZE; cpu ++) {
+		if(!CPU_ISSET(cpu, &saved))
+			continue;
+		hm_bench_pin((int)cpu);
+		if(getcpu(NULL, &node) || node >= nodes || cpus[node] >= 0)
+			continue;
+		cpus[node] = (int)cpu;
+	}
+	sched_setaffinity(0, sizeof(saved), &saved);
+}
+
+/* where the kernel put the pages of addrs, counting the ones on node */
+static uint64_t hm_bench_numa_local(void** pages, uint64_t count, u32 node)
+{
+	uint64_t index, local;
+	int* status;
+
+	status = calloc(count, sizeof(int));
+	if(!status)
+		abort();
+	if(syscall(SYS_move_pages, 0, (unsigned long)count, pages, NULL, status, 0))
+		abort();
+
+	local = 0;
+	for(index = 0; index < count; index ++)
+		local += status[index] == (int)node;
+	free(status);
+
+	return local;
+}
+
+static void* hm_bench_numa_alloc(void* arg)
+{
+	hm_bench_place* place = arg;
+	uint64_t i, n, large;
+	void** pages;
+	char* page;
+
+	hm_bench_pin(place->cpu);
+	hm_task_rebind();
+	if(hm_task_self()->mem.node != place->node)
+		abort();
+
+	large = HM_BENCH_NUMA_LARGE/HM_PAGE_SIZE;
+	pages = calloc(place->count+large, sizeof(void* ));
+	if(!pages)
+		abort();
+
+	n = 0;
+	for(i = 0; i < place->count; i ++) {
+		place->ptrs[i] = hm_malloc(HM_BENCH_NUMA_BLOCK);
+		memset(place->ptrs[i], (int)i, HM_BENCH_NUMA_BLOCK);
+		page = (char* )hm_align_down((uintptr_t)place->ptrs[i], HM_PAGE_SIZE);
+		if(!n || pages[n-1] != page)
+			pages[n ++] = page;
+	}
+	place->ptrs[i] = hm_malloc(HM_BENCH_NUMA_LARGE);
+	memset(place->ptrs[i], 1, HM_BENCH_NUMA_LARGE);
+	for(i = 0; i < large; i ++)
+		pages[n ++] = (char* )place->ptrs[place->count]+i*HM_PAGE_SIZE;
+
+	place->pages = n;
+	place->local = hm_bench_numa_local(pages, n, place->node);
+	if(syscall(SYS_get_mempolicy, &place->policy, &place->mask, sizeof(place->mask)*8,
+		place->ptrs[0], MPOL_F_ADDR))
+		abort();
+
+	free(pages);
+	return NULL;
+}
+
+/* frees of another node's blocks, they have to end up back there */
+static void* hm_bench_numa_free(void* arg)
+{
+	hm_bench_place* place = arg;
+	uint64_t i;
+
+	hm_bench_pin(place->cpu);
+	hm_task_rebind();
+	for(i = 0; i <= place->count; i ++)
+		hm_free(place->frees[i]);
+	return NULL;
+}
+
+/* placement of task memory checked with move_pages and get_mempolicy */
+void hm_bench_numa()
+{
+	hm_stats before[HM_NODE_MAX], after;
+	hm_bench_place* places;
+	int cpus[HM_NODE_MAX];
+	u32 nodes, node, used;
+	uint64_t count;
+
+	if(hm_bench.alloc->alloc != hm_malloc)
+		return;
+
+	nodes = hm_mgr_main.nodes;
+	hm_bench_numa_cpus(cpus, nodes);
+	count = hm_bench_iters(65536);
+
+	places = calloc(nodes, sizeof(hm_bench_place));
+	if(!places)
+		abort();
+
+	used = 0;
+	for(node = 0; node < nodes; node ++) {
+		if(cpus[node] < 0)
+			continue;
+		hm_mgr_node_stats(&hm_mgr_main, node, &before[node]);
+		places[used].cpu = cpus[node];
+		places[used].node = node;
+		places[used].count = count;
+		places[used].ptrs = calloc(count+1, sizeof(void* ));
+		if(!places[used].ptrs)
+			abort();
+		used ++;
+	}
+	hm_bench_run((int)used, hm_bench_numa_alloc, places, sizeof(hm_bench_place));
+
+	for(node = 0; node < used; node ++) {
+		/* one arena has no policy, more than one prefer their own node */
+		if(nodes > 1 && (places[node].policy != 1 || !(places[node].mask&(1ul<<places[node].node))))
+			abort();
+		if(nodes > 1 && places[node].local*10 < places[node].pages*9)
+			abort();
+
+		hm_bench_begin("numa");
+		hm_bench_u64("nodes", nodes);
+		hm_bench_u64("node", places[node].node);
+		hm_bench_u64("cpu", (uint64_t)places[node].cpu);
+		hm_bench_u64("policy", (uint64_t)places[node].policy);
+		hm_bench_u64("pages", places[node].pages);
+		hm_bench_u64("local", places[node].local);
+		hm_bench_end();
+	}
+
+	/* every node frees what the next one allocated */
+	for(node = 0; node < used; node ++)
+		places[node].frees = places[(node+1)%used].ptrs;
+	hm_bench_run((int)used, hm_bench_numa_free, places, sizeof(hm_bench_place));
+
+	for(node = 0; node < used; node ++) {
+		hm_mgr_node_stats(&hm_mgr_main, places[node].node, &after);
+		if(after.spans != before[places[node].node].spans || after.large != before[places[node].node].large)
+			abort();
+		free(places[node].ptrs);
+	}
+	free(places);
+}
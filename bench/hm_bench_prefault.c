@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "hm_bench.h"
+
+#define HM_BENCH_TOUCH 1024
+/* well past HM_DIRTY_MAX spans */
+#define HM_BENCH_KEEP (16u<<20)
+
+typedef struct hm_bench_touch_s {
+	uint64_t* lat;
+	uint64_t count;
+	uint64_t faults;
+}hm_bench_touch;
+
+static int hm_bench_cmp(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t* )a, y = *(const uint64_t* )b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t hm_bench_faults()
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_THREAD, &usage);
+	return (uint64_t)usage.ru_minflt;
+}
+
+/* a fresh thread allocating and writing its first blocks */
+static void* hm_bench_prefault_worker(void* arg)
+{
+	hm_bench_touch* touch = arg;
+	uint64_t i, start, faults;
+	void** ptrs;
+
+	ptrs = calloc(touch->count, sizeof(void* ));
+	if(!ptrs)
+		abort();
+
+	faults = hm_bench_faults();
+	for(i = 0; i < touch->count; i ++) {
+		start = hm_bench_now();
+		ptrs[i] = hm_bench.alloc->alloc(HM_BENCH_TOUCH);
+		memset(ptrs[i], (int)i, HM_BENCH_TOUCH);
+		touch->lat[i] = hm_bench_now()-start;
+	}
+	touch->faults = hm_bench_faults()-faults;
+
+	for(i = 0; i < touch->count; i ++)
+		hm_bench.alloc->free(ptrs[i]);
+	free(ptrs);
+	return NULL;
+}
+
+static uint64_t hm_bench_prefault_run(const char* mode, uint64_t count)
+{
+	hm_bench_touch touch;
+
+	touch.count = count;
+	touch.lat = calloc(count, sizeof(uint64_t));
+	if(!touch.lat)
+		abort();
+
+	hm_bench_run(1, hm_bench_prefault_worker, &touch, sizeof(touch));
+	qsort(touch.lat, count, sizeof(uint64_t), hm_bench_cmp);
+
+	hm_bench_begin("prefault");
+	hm_bench_str("mode", mode);
+	hm_bench_u64("blocks", count);
+	hm_bench_u64("faults", touch.faults);
+	hm_bench_u64("p50_ns", touch.lat[count/2]);
+	hm_bench_u64("p99_ns", touch.lat[count*99/100]);
+	hm_bench_u64("p999_ns", touch.lat[count*999/1000]);
+	hm_bench_u64("max_ns", touch.lat[count-1]);
+	hm_bench_end();
+
+	free(touch.lat);
+	return touch.faults;
+}
+
+/* spans prefaulted without a pin survive the releases of a thread that comes and goes */
+static void hm_bench_prefault_keep()
+{
+	size_t spans = HM_BENCH_KEEP>>HM_SPAN_SHIFT;
+	u32 node = hm_mgr_node(&hm_mgr_main);
+	hm_stats stats;
+
+	hm_mgr_purge(&hm_mgr_main, 0);
+	if(hm_mgr_prefault(&hm_mgr_main, node, HM_BENCH_KEEP, 0))
+		abort();
+	hm_bench_prefault_run("keep", (HM_BENCH_KEEP/HM_BENCH_TOUCH)>>4);
+
+	hm_mgr_node_stats(&hm_mgr_main, node, &stats);
+	hm_bench_begin("prefault_keep");
+	hm_bench_u64("prefaulted", spans);
+	hm_bench_u64("dirty", stats.spans_dirty);
+	hm_bench_u64("pinned", stats.spans_pinned);
+	hm_bench_end();
+	if(stats.spans_dirty+stats.spans_pinned < spans)
+		abort();
+	hm_mgr_purge(&hm_mgr_main, 0);
+}
+
+/* the same first allocations cold, then with the work moved to registration */
+void hm_bench_prefault()
+{
+	size_t bytes[HM_CLASS_MAX] = { 0 };
+	uint64_t count, cold;
+
+	count = hm_bench_iters(16384);
+	hm_mgr_purge(&hm_mgr_main, 0);
+	cold = hm_bench_prefault_run("cold", count);
+
+	if(hm_bench.alloc->alloc != hm_malloc)
+		return;
+
+	bytes[hm_pool_class(HM_BENCH_TOUCH)] = (size_t)count*HM_BENCH_TOUCH;
+	hm_task_set_reserve(bytes, 0);
+	hm_mgr_purge(&hm_mgr_main, 0);
+	if(hm_bench_prefault_run("reserve", count) >= cold)
+		abort();
+	hm_task_set_reserve(NULL, 0);
+	hm_bench_prefault_keep();
+
+	hm_task_set_reserve(bytes, HM_PREFAULT_PIN);
+	hm_mgr_purge(&hm_mgr_main, 0);
+	if(hm_bench_prefault_run("reserve_pin", count) >= cold)
+		abort();
+	hm_task_set_reserve(NULL, 0);
+}
@@ -0,0 +1,199 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "hm_bench.h"
+#include "hm_shm.h"
+
+#define HM_BENCH_MSG 4080
+#define HM_BENCH_WINDOW 512
+#define HM_BENCH_ACK 64
+#define HM_BENCH_LEAK 1000
+
+static int hm_bench_io(int fd, void* buf, size_t size, int out)
+{
+	ssize_t n;
+
+	while(size) {
+		n = out ? write(fd, buf, size) : read(fd, buf, size);
+		if(n <= 0)
+			return -1;
+		buf = (char* )buf+n;
+		size -= (size_t)n;
+	}
+	return 0;
+}
+
+/* the peer checks every message and hands back a credit every HM_BENCH_ACK */
+static int hm_bench_shm_peer(hm_shm* shm, int fd, uint64_t count, int copy)
+{
+	char msg[HM_BENCH_MSG];
+	hm_shm_ptr ptr;
+	uint64_t i, ack;
+	uint64_t* body;
+
+	for(i = 0; i < count; i ++) {
+		if(copy) {
+			if(hm_bench_io(fd, msg, sizeof(msg), 0))
+				return -1;
+			body = (uint64_t* )msg;
+		}
+		else {
+			if(hm_bench_io(fd, &ptr, sizeof(ptr), 0))
+				return -1;
+			body = hm_shm_addr(shm, ptr);
+		}
+
+		if(body[0] != i || ((char* )body)[HM_BENCH_MSG-1] != (char)i)
+			return -1;
+		if(!copy)
+			hm_shm_free(shm, ptr);
+
+		if((i+1)%HM_BENCH_ACK == 0 || i+1 == count) {
+			ack = i+1;
+			if(hm_bench_io(fd, &ack, sizeof(ack), 1))
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static double hm_bench_shm_pass(hm_shm* shm, uint64_t count, int copy)
+{
+	char msg[HM_BENCH_MSG];
+	uint64_t i, acked, start;
+	hm_shm_ptr ptr;
+	int fds[2], status;
+	uint64_t* body;
+	pid_t pid;
+
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+		abort();
+
+	pid = fork();
+	if(pid < 0)
+		abort();
+	if(!pid) {
+		hm_shm* peer;
+
+		close(fds[0]);
+		peer = hm_shm_attach(shm->fd);
+		if(!peer)
+			_exit(1);
+		status = hm_bench_shm_peer(peer, fds[1], count, copy);
+		hm_shm_close(peer);
+		_exit(status ? 1 : 0);
+	}
+	close(fds[1]);
+
+	start = hm_bench_now();
+	for(i = 0, acked = 0; i < count; i ++) {
+		while(i-acked >= HM_BENCH_WINDOW) {
+			if(hm_bench_io(fds[0], &acked, sizeof(acked), 0))
+				abort();
+		}
+
+		if(copy) {
+			body = (uint64_t* )msg;
+			body[0] = i;
+			msg[HM_BENCH_MSG-1] = (char)i;
+			if(hm_bench_io(fds[0], msg, sizeof(msg), 1))
+				abort();
+		}
+		else {
+			ptr = hm_shm_alloc(shm, HM_BENCH_MSG);
+			if(!ptr)
+				abort();
+			body = hm_shm_addr(shm, ptr);
+			body[0] = i;
+			((char* )body)[HM_BENCH_MSG-1] = (char)i;
+			if(hm_bench_io(fds[0], &ptr, sizeof(ptr), 1))
+				abort();
+		}
+	}
+	while(acked < count) {
+		if(hm_bench_io(fds[0], &acked, sizeof(acked), 0))
+			abort();
+	}
+	close(fds[0]);
+
+	if(waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status))
+		abort();
+	return (double)count*1e9/(double)(hm_bench_now()-start);
+}
+
+/* a peer allocates and dies without freeing, its blocks must come back */
+static size_t hm_bench_shm_crash(hm_shm* shm)
+{
+	int status;
+	pid_t pid;
+
+	pid = fork();
+	if(pid < 0)
+		abort();
+	if(!pid) {
+		hm_shm* peer;
+		int index;
+
+		peer = hm_shm_attach(shm->fd);
+		if(!peer)
+			_exit(1);
+		for(index = 0; index < HM_BENCH_LEAK-1; index ++) {
+			if(!hm_shm_alloc(peer, 16+(size_t)(index%64)*64))
+				_exit(1);
+		}
+		if(!hm_shm_alloc(peer, 1u<<20))
+			_exit(1);
+		_exit(0);
+	}
+
+	if(waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status))
+		abort();
+	return hm_shm_recover(shm);
+}
+
+void hm_bench_shm()
+{
+	size_t spans, leaked, recovered;
+	uint64_t count;
+	double rate;
+	hm_shm* shm;
+
+	shm = hm_shm_create(NULL, 32u<<20);
+	if(!shm)
+		abort();
+	count = hm_bench_iters(200000);
+
+	rate = hm_bench_shm_pass(shm, count, 0);
+	spans = hm_shm_spans(shm);
+
+	hm_bench_begin("shm");
+	hm_bench_str("mode", "zero_copy");
+	hm_bench_u64("msg_bytes", HM_BENCH_MSG);
+	hm_bench_f64("msgs_per_sec", rate);
+	hm_bench_u64("spans", spans);
+	hm_bench_end();
+
+	rate = hm_bench_shm_pass(shm, count, 1);
+
+	hm_bench_begin("shm");
+	hm_bench_str("mode", "socket_copy");
+	hm_bench_u64("msg_bytes", HM_BENCH_MSG);
+	hm_bench_f64("msgs_per_sec", rate);
+	hm_bench_end();
+
+	recovered = hm_bench_shm_crash(shm);
+	leaked = hm_shm_spans(shm);
+	if(recovered != HM_BENCH_LEAK || leaked != spans)
+		abort();
+
+	hm_bench_begin("shm");
+	hm_bench_str("mode", "crash_recovery");
+	hm_bench_u64("recovered", recovered);
+	hm_bench_u64("spans", leaked);
+	hm_bench_end();
+
+	hm_shm_close(shm);
+}
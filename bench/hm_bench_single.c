@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "hm_bench.h"
+
+#define HM_BENCH_BATCH 256
+#define HM_BENCH_REPEAT 3
+
+/* best of a few runs, allocation and free of one size back to back */
+static double hm_bench_pair(size_t size, uint64_t iters)
+{
+	uint64_t start, best, i;
+	void* volatile ptr;
+	int repeat;
+
+	best = ~0ull;
+	for(repeat = 0; repeat < HM_BENCH_REPEAT; repeat ++) {
+		start = hm_bench_now();
+		for(i = 0; i < iters; i ++) {
+			ptr = hm_bench.alloc->alloc(size);
+			hm_bench.alloc->free(ptr);
+		}
+		start = hm_bench_now()-start;
+		if(start < best)
+			best = start;
+	}
+
+	return (double)best/(double)(iters*2);
+}
+
+/* a batch of allocations followed by a batch of frees, touching each block */
+static double hm_bench_batch(size_t size, uint64_t iters)
+{
+	void* ptrs[HM_BENCH_BATCH];
+	uint64_t start, best, i;
+	int repeat, index;
+
+	best = ~0ull;
+	for(repeat = 0; repeat < HM_BENCH_REPEAT; repeat ++) {
+		start = hm_bench_now();
+		for(i = 0; i < iters; i += HM_BENCH_BATCH) {
+			for(index = 0; index < HM_BENCH_BATCH; index ++) {
+				ptrs[index] = hm_bench.alloc->alloc(size);
+				*(char* )ptrs[index] = (char)index;
+			}
+			for(index = 0; index < HM_BENCH_BATCH; index ++)
+				hm_bench.alloc->free(ptrs[index]);
+		}
+		start = hm_bench_now()-start;
+		if(start < best)
+			best = start;
+	}
+
+	return (double)best/(double)(hm_align_up(iters, HM_BENCH_BATCH)*2);
+}
+
+void hm_bench_latency()
+{
+	uint64_t iters;
+	u32 klass;
+	size_t size;
+
+	for(klass = 1; klass < hm_pool_classes; klass ++) {
+		size = hm_pool_sizes[klass];
+		iters = hm_bench_iters(size <= 1024 ? 2000000 : 200000);
+
+		hm_bench_begin("latency");
+		hm_bench_u64("class", klass);
+		hm_bench_u64("size", size);
+		hm_bench_u64("iters", iters);
+		hm_bench_f64("pair_ns", hm_bench_pair(size, iters));
+		hm_bench_f64("batch_ns", hm_bench_batch(size, iters));
+		hm_bench_end();
+	}
+}
+
+static void hm_bench_frag_report(const char* phase, size_t live, size_t count)
+{
+	hm_stats stats;
+	size_t rss;
+
+	hm_mgr_stats(&hm_mgr_main, &stats);
+	rss = hm_bench_rss();
+
+	hm_bench_begin("frag");
+	hm_bench_str("phase", phase);
+	hm_bench_u64("objects", count);
+	hm_bench_u64("live_bytes", live);
+	hm_bench_u64("rss_bytes", rss);
+	hm_bench_u64("mapped_bytes", stats.mapped);
+	hm_bench_u64("spans", stats.spans);
+	hm_bench_u64("spans_dirty", stats.spans_dirty);
+	hm_bench_f64("rss_ratio", live ? (double)rss/(double)live : 0.0);
+	hm_bench_end();
+}
+
+/*
+ * span occupancy of every class in use, from hm_mgr_frag(). with live set,
+ * the blocks counted used have to be exactly the live ones of each class.
+ */
+static void hm_bench_frag_classes(const char* phase, const size_t* live)
+{
+	hm_frag frag[HM_CLASS_MAX];
+	char histogram[HM_FRAG_BUCKETS*24];
+	size_t length;
+	u32 klass, bucket;
+
+	hm_mgr_frag(&hm_mgr_main, frag);
+	for(klass = 1; klass < hm_pool_classes; klass ++) {
+		if(live && frag[klass].used != live[klass])
+			abort();
+		if(!frag[klass].spans)
+			continue;
+
+		length = 0;
+		for(bucket = 0; bucket < HM_FRAG_BUCKETS; bucket ++)
+			length += (size_t)snprintf(histogram+length, sizeof(histogram)-length, "%s%zu",
+				bucket ? "," : "", frag[klass].histogram[bucket]);
+
+		hm_bench_begin("frag_class");
+		hm_bench_str("phase", phase);
+		hm_bench_u64("size", frag[klass].size);
+		hm_bench_u64("spans", frag[klass].spans);
+		hm_bench_u64("used", frag[klass].used);
+		hm_bench_u64("wasted_bytes", frag[klass].wasted);
+		hm_bench_str("occupancy", histogram);
+		hm_bench_end();
+	}
+}
+
+/*
+ * fill with small objects, free most of them at random, then allocate a
+ * larger size mix into the holes and see how much of the rss is recycled.
+ * hotmem also reports its spans and trims after the sparse and drained phases.
+ */
+void hm_bench_frag()
+{
+	uint64_t rand = 0x9e3779b97f4a7c15ull;
+	size_t count, index, live, objects, size;
+	size_t classes[HM_CLASS_MAX];
+	hm_stats stats;
+	size_t* sizes;
+	void** ptrs;
+
+	count = (size_t)hm_bench_iters(1u<<20);
+	ptrs = calloc(count, sizeof(void* ));
+	sizes = calloc(count, sizeof(size_t));
+	if(!ptrs || !sizes)
+		abort();
+
+	hm_bench_frag_report("start", 0, 0);
+
+	live = objects = 0;
+	for(index = 0; index < count; index ++) {
+		size = hm_bench_size(&rand, 16, 256);
+		ptrs[index] = hm_bench.alloc->alloc(size);
+		memset(ptrs[index], 0xa5, size);
+		sizes[index] = size;
+		live += size;
+		objects ++;
+	}
+	hm_bench_frag_report("filled", live, objects);
+
+	for(index = 0; index < count; index ++) {
+		if(hm_bench_rand(&rand)%10) {
+			hm_bench.alloc->free(ptrs[index]);
+			live -= sizes[index];
+			objects --;
+			ptrs[index] = NULL;
+		}
+	}
+	hm_bench_frag_report("sparse", live, objects);
+	if(hm_bench.alloc->alloc == hm_malloc) {
+		hm_bench_frag_classes("sparse", NULL);
+		hm_mem_trim();
+		hm_bench_frag_report("trimmed", live, objects);
+
+		/* the drained caches hold nothing, only the objects still live are used */
+		memset(classes, 0, sizeof(classes));
+		for(index = 0; index < count; index ++) {
+			if(ptrs[index])
+				classes[hm_pool_class(sizes[index])] ++;
+		}
+		hm_bench_frag_classes("trimmed", classes);
+	}
+
+	for(index = 0; index < count; index ++) {
+		if(!ptrs[index] && hm_bench_rand(&rand)%2) {
+			size = hm_bench_size(&rand, 256, 2048);
+			ptrs[index] = hm_bench.alloc->alloc(size);
+			memset(ptrs[index], 0x5a, size);
+			sizes[index] = size;
+			live += size;
+			objects ++;
+		}
+	}
+	hm_bench_frag_report("refilled", live, objects);
+
+	for(index = 0; index < count; index ++)
+		hm_bench.alloc->free(ptrs[index]);
+	hm_bench_frag_report("drained", 0, 0);
+	if(hm_bench.alloc->alloc == hm_malloc) {
+		hm_mem_trim();
+		hm_bench_frag_report("released", 0, 0);
+		hm_mgr_stats(&hm_mgr_main, &stats);
+		if(stats.mapped || stats.spans)
+			abort();
+	}
+
+	free(sizes);
+	free(ptrs);
+}
+
+/* most allocations at a few odd sizes, the rest spread out */
+static const size_t hm_bench_spikes[] = { 40, 136, 260, 520, 1050, 2100, 4200 };
+
+/* internal fragmentation of the active size class table on a spiky mix */
+void hm_bench_classes()
+{
+	uint64_t rand = 0x9e3779b97f4a7c15ull;
+	size_t count, index, requested, usable, size;
+	void** ptrs;
+
+	if(hm_bench.alloc->alloc != hm_malloc)
+		return;
+
+	count = (size_t)hm_bench_iters(1u<<18);
+	ptrs = calloc(count, sizeof(void* ));
+	if(!ptrs)
+		abort();
+
+	if(hm_bench.profile)
+		hm_pool_profile_start();
+	requested = usable = 0;
+	for(index = 0; index < count; index ++) {
+		if(hm_bench_rand(&rand)%4)
+			size = hm_bench_spikes[hm_bench_rand(&rand)%array_size(hm_bench_spikes)];
+		else
+			size = hm_bench_size(&rand, 16, 8192);
+		ptrs[index] = hm_malloc(size);
+		requested += size;
+		usable += hm_usable_size(ptrs[index]);
+	}
+	if(hm_bench.profile) {
+		hm_pool_profile_stop();
+		if(hm_pool_profile_dump(hm_bench.profile))
+			abort();
+	}
+
+	hm_bench_begin("classes");
+	hm_bench_u64("classes", hm_pool_classes-1);
+	hm_bench_u64("objects", count);
+	hm_bench_u64("requested_bytes", requested);
+	hm_bench_u64("usable_bytes", usable);
+	hm_bench_f64("waste_pct", 100.0*(double)(usable-requested)/(double)usable);
+	hm_bench_end();
+
+	for(index = 0; index < count; index ++)
+		hm_free(ptrs[index]);
+	free(ptrs);
+}
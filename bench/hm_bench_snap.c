@@ -0,0 +1,199 @@
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "hm_bench.h"
+
+#define HM_BENCH_SNAP_BUCKETS (1u<<16)
+#define HM_BENCH_SNAP_SIZE (256u<<20)
+
+/* a lookup table of many small blocks, the kind services build at startup */
+typedef struct hm_bench_entry_s {
+	struct hm_bench_entry_s* next;
+	char* key;
+	uint64_t value;
+}hm_bench_entry;
+
+typedef struct hm_bench_table_s {
+	uint64_t count;
+	/* buckets with an entry */
+	uint64_t used;
+	hm_bench_entry* buckets[HM_BENCH_SNAP_BUCKETS];
+}hm_bench_table;
+
+static uint64_t hm_bench_snap_hash(uint64_t value)
+{
+	value *= 0x9e3779b97f4a7c15ull;
+	return value^(value>>29);
+}
+
+static hm_bench_table* hm_bench_snap_build(hm_snap* snap, uint64_t count)
+{
+	hm_bench_table* table;
+	hm_bench_entry* entry;
+	uint64_t i, bucket;
+	char key[32];
+	int length;
+
+	table = hm_snap_alloc(snap, sizeof(hm_bench_table));
+	if(!table)
+		abort();
+	memset(table, 0, sizeof(hm_bench_table));
+	table->count = count;
+
+	for(i = 0; i < count; i ++) {
+		length = snprintf(key, sizeof(key), "key-%llu", (unsigned long long)i);
+		entry = hm_snap_alloc(snap, sizeof(hm_bench_entry));
+		if(!entry || !(entry->key = hm_snap_alloc(snap, (size_t)length+1)))
+			abort();
+		memcpy(entry->key, key, (size_t)length+1);
+		entry->value = hm_bench_snap_hash(i);
+
+		bucket = entry->value%HM_BENCH_SNAP_BUCKETS;
+		entry->next = table->buckets[bucket];
+		table->buckets[bucket] = entry;
+		if(hm_snap_reloc(snap, &entry->next) || hm_snap_reloc(snap, &entry->key))
+			abort();
+		/* the head moves with the bucket, it is registered once */
+		if(!entry->next) {
+			if(hm_snap_reloc(snap, &table->buckets[bucket]))
+				abort();
+			table->used ++;
+		}
+	}
+	return table;
+}
+
+/* every key is found with its value */
+static int hm_bench_snap_check(hm_bench_table* table)
+{
+	hm_bench_entry* entry;
+	uint64_t i, value;
+	char key[32];
+
+	for(i = 0; i < table->count; i ++) {
+		snprintf(key, sizeof(key), "key-%llu", (unsigned long long)i);
+		value = hm_bench_snap_hash(i);
+		for(entry = table->buckets[value%HM_BENCH_SNAP_BUCKETS]; entry; entry = entry->next) {
+			if(!strcmp(entry->key, key))
+				break;
+		}
+		if(!entry || entry->value != value)
+			return -1;
+	}
+	return 0;
+}
+
+/* a write to a read only snapshot has to fault */
+static int hm_bench_snap_readonly(hm_bench_table* table)
+{
+	int status;
+	pid_t pid;
+
+	fflush(hm_bench.out);
+	pid = fork();
+	if(pid < 0)
+		abort();
+	if(!pid) {
+		table->count = 0;
+		_exit(0);
+	}
+	if(waitpid(pid, &status, 0) != pid)
+		abort();
+	return WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV;
+}
+
+static hm_snap* hm_bench_snap_load(const char* path, u32 flags, const char* mode, uint64_t build)
+{
+	hm_bench_table* table;
+	hm_bench_entry* entry;
+	uint64_t start, load;
+	hm_snap* snap;
+	int readonly;
+
+	start = hm_bench_now();
+	snap = hm_snap_load(path, flags);
+	load = hm_bench_now()-start;
+	if(!snap)
+		abort();
+
+	table = hm_snap_root(snap);
+	entry = table->buckets[hm_bench_snap_hash(0)%HM_BENCH_SNAP_BUCKETS];
+	if(hm_bench_snap_check(table) || hm_usable_size(entry) < sizeof(hm_bench_entry))
+		abort();
+	/* frees of snapshot blocks do nothing */
+	hm_free(entry);
+	hm_free(entry->key);
+	if(hm_bench_snap_check(table))
+		abort();
+	readonly = hm_bench_snap_readonly(table);
+
+	hm_bench_begin("snap");
+	hm_bench_str("mode", mode);
+	hm_bench_u64("entries", table->count);
+	hm_bench_u64("bytes", snap->size);
+	hm_bench_u64("build_ns", build);
+	hm_bench_u64("load_ns", load);
+	hm_bench_u64("readonly", (uint64_t)readonly);
+	hm_bench_end();
+
+	if(readonly != !(flags&HM_SNAP_COW))
+		abort();
+	return snap;
+}
+
+/* build a table once, then map it back at its own base and at another one */
+void hm_bench_snap()
+{
+	char path[] = "/tmp/hotmem_snap.XXXXXX";
+	uint64_t count, start, build;
+	hm_bench_table* table;
+	hm_snap *snap, *loaded;
+	void *base, *taken;
+	int fd;
+
+	if(hm_bench.alloc->alloc != hm_malloc)
+		return;
+
+	fd = mkstemp(path);
+	if(fd < 0)
+		abort();
+	close(fd);
+
+	count = hm_bench_iters(1u<<20);
+	snap = hm_snap_create(NULL, HM_BENCH_SNAP_SIZE);
+	if(!snap)
+		abort();
+	start = hm_bench_now();
+	table = hm_bench_snap_build(snap, count);
+	build = hm_bench_now()-start;
+	hm_snap_set_root(snap, table);
+	/* a field registered again is still moved once */
+	if(hm_snap_reloc(snap, &table->buckets[0]) || hm_snap_reloc(snap, &table->buckets[0]))
+		abort();
+	if(hm_snap_save(snap, path) || snap->nrelocs != 2*count+table->used+!table->buckets[0])
+		abort();
+	base = snap->base;
+	hm_snap_close(snap);
+
+	loaded = hm_bench_snap_load(path, 0, "fixed", build);
+	if(loaded->base != base)
+		abort();
+	hm_snap_close(loaded);
+
+	/* someone else sits at the base now */
+	taken = hm_os_map_at(base, HM_CHUNK_SIZE);
+	if(!taken || hm_snap_load(path, HM_SNAP_FIXED))
+		abort();
+	loaded = hm_bench_snap_load(path, 0, "relocated", build);
+	hm_snap_close(loaded);
+	loaded = hm_bench_snap_load(path, HM_SNAP_COW, "cow", build);
+	table = hm_snap_root(loaded);
+	table->count = 1;
+	hm_snap_close(loaded);
+	hm_os_unmap(taken, HM_CHUNK_SIZE);
+
+	unlink(path);
+}
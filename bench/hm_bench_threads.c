@@ -0,0 +1,412 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "hm_bench.h"
+
+#define HM_BENCH_SLOTS 256
+#define HM_BENCH_RING 1024
+#define HM_BENCH_XBATCH 64
+
+typedef struct hm_bench_worker_s {
+	uint64_t rand;
+	uint64_t ops;
+	uint64_t nsec;
+	void* shared;
+	int index;
+}hm_bench_worker;
+
+static hm_bench_worker* hm_bench_workers(int threads)
+{
+	hm_bench_worker* workers;
+	int index;
+
+	workers = calloc((size_t)threads, sizeof(hm_bench_worker));
+	if(!workers)
+		abort();
+	for(index = 0; index < threads; index ++) {
+		workers[index].rand = 0x2545f4914f6cdd1dull*(uint64_t)(index+1);
+		workers[index].index = index;
+	}
+	return workers;
+}
+
+/* wall time of the slowest worker */
+static uint64_t hm_bench_elapsed(hm_bench_worker* workers, int threads)
+{
+	uint64_t nsec = 1;
+	int index;
+
+	for(index = 0; index < threads; index ++) {
+		if(workers[index].nsec > nsec)
+			nsec = workers[index].nsec;
+	}
+	return nsec;
+}
+
+/* aggregate throughput over the slowest worker */
+static double hm_bench_rate(hm_bench_worker* workers, int threads)
+{
+	uint64_t ops = 0;
+	int index;
+
+	for(index = 0; index < threads; index ++)
+		ops += workers[index].ops;
+	return (double)ops*1e9/(double)hm_bench_elapsed(workers, threads);
+}
+
+/* scaling: random replacement inside a private working set */
+static void* hm_bench_scaling_worker(void* arg)
+{
+	hm_bench_worker* worker = arg;
+	void* slots[HM_BENCH_SLOTS] = { 0 };
+	uint64_t iters, i, start;
+	size_t index;
+
+	iters = hm_bench_iters(2000000);
+	start = hm_bench_now();
+	for(i = 0; i < iters; i ++) {
+		index = (size_t)(hm_bench_rand(&worker->rand)%HM_BENCH_SLOTS);
+		hm_bench.alloc->free(slots[index]);
+		slots[index] = hm_bench.alloc->alloc(hm_bench_size(&worker->rand, 16, 1024));
+	}
+	for(index = 0; index < HM_BENCH_SLOTS; index ++)
+		hm_bench.alloc->free(slots[index]);
+
+	worker->nsec = hm_bench_now()-start;
+	worker->ops = iters;
+	return NULL;
+}
+
+void hm_bench_scaling()
+{
+	hm_bench_worker* workers;
+	double rate, base = 0;
+	int threads;
+
+	for(threads = 1; ; threads <<= 1) {
+		if(threads > hm_bench.threads)
+			threads = hm_bench.threads;
+
+		workers = hm_bench_workers(threads);
+		hm_bench_run(threads, hm_bench_scaling_worker, workers, sizeof(hm_bench_worker));
+		rate = hm_bench_rate(workers, threads);
+		if(threads == 1)
+			base = rate;
+		free(workers);
+
+		hm_bench_begin("scaling");
+		hm_bench_u64("threads", (uint64_t)threads);
+		hm_bench_f64("ops_per_sec", rate);
+		hm_bench_f64("speedup", base ? rate/base : 0.0);
+		hm_bench_end();
+
+		if(threads == hm_bench.threads)
+			break;
+	}
+}
+
+/* single producer single consumer ring */
+typedef struct hm_bench_ring_s {
+	void* slots[HM_BENCH_RING];
+	uint64_t head;
+	uint64_t tail;
+	uint64_t count;
+}hm_bench_ring;
+
+static void* hm_bench_producer(void* arg)
+{
+	hm_bench_worker* worker = arg;
+	hm_bench_ring* ring = worker->shared;
+	uint64_t i, start;
+
+	start = hm_bench_now();
+	for(i = 0; i < ring->count; i ++) {
+		while(i-__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= HM_BENCH_RING)
+			sched_yield();
+		ring->slots[i%HM_BENCH_RING] = hm_bench.alloc->alloc(hm_bench_size(&worker->rand, 16, 512));
+		__atomic_store_n(&ring->head, i+1, __ATOMIC_RELEASE);
+	}
+	worker->nsec = hm_bench_now()-start;
+	worker->ops = ring->count;
+	return NULL;
+}
+
+static void* hm_bench_consumer(void* arg)
+{
+	hm_bench_worker* worker = arg;
+	hm_bench_ring* ring = worker->shared;
+	uint64_t i, start;
+
+	start = hm_bench_now();
+	for(i = 0; i < ring->count; i ++) {
+		while(__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) <= i)
+			sched_yield();
+		hm_bench.alloc->free(ring->slots[i%HM_BENCH_RING]);
+		__atomic_store_n(&ring->tail, i+1, __ATOMIC_RELEASE);
+	}
+	worker->nsec = hm_bench_now()-start;
+	worker->ops = ring->count;
+	return NULL;
+}
+
+static void* hm_bench_prodcons_worker(void* arg)
+{
+	hm_bench_worker* worker = arg;
+
+	if(worker->index&1)
+		return hm_bench_consumer(arg);
+	return hm_bench_producer(arg);
+}
+
+/* every block is freed by a thread other than the one that allocated it */
+void hm_bench_prodcons()
+{
+	hm_bench_worker* workers;
+	hm_bench_ring* rings;
+	int pairs, threads, index;
+
+	pairs = hm_bench.threads/2;
+	if(pairs < 1)
+		pairs = 1;
+	threads = pairs*2;
+
+	rings = calloc((size_t)pairs, sizeof(hm_bench_ring));
+	workers = hm_bench_workers(threads);
+	if(!rings)
+		abort();
+	for(index = 0; index < threads; index ++) {
+		rings[index/2].count = hm_bench_iters(1000000);
+		workers[index].shared = &rings[index/2];
+	}
+
+	hm_bench_run(threads, hm_bench_prodcons_worker, workers, sizeof(hm_bench_worker));
+
+	hm_bench_begin("prodcons");
+	hm_bench_u64("pairs", (uint64_t)pairs);
+	hm_bench_f64("ops_per_sec", hm_bench_rate(workers, threads)/2);
+	hm_bench_end();
+
+	free(workers);
+	free(rings);
+}
+
+/* short lived threads, each registering a task, using it briefly and leaving */
+static void* hm_bench_churn_worker(void* arg)
+{
+	hm_bench_worker* worker = arg;
+	void* slots[64];
+	int index, round;
+
+	for(round = 0; round < 16; round ++) {
+		for(index = 0; index < 64; index ++)
+			slots[index] = hm_bench.alloc->alloc(hm_bench_size(&worker->rand, 16, 2048));
+		for(index = 0; index < 64; index ++)
+			hm_bench.alloc->free(slots[index]);
+	}
+	worker->ops = 16*64;
+	return NULL;
+}
+
+void hm_bench_churn()
+{
+	hm_bench_worker* workers;
+	uint64_t rounds, round, start, nsec;
+	hm_stats stats;
+	int threads;
+
+	threads = hm_bench.threads;
+	rounds = hm_bench_iters(400);
+
+	start = hm_bench_now();
+	for(round = 0; round < rounds; round ++) {
+		workers = hm_bench_workers(threads);
+		hm_bench_run(threads, hm_bench_churn_worker, workers, sizeof(hm_bench_worker));
+		free(workers);
+	}
+	nsec = hm_bench_now()-start;
+	hm_mgr_stats(&hm_mgr_main, &stats);
+
+	hm_bench_begin("churn");
+	hm_bench_u64("threads", (uint64_t)threads);
+	hm_bench_u64("rounds", rounds);
+	hm_bench_f64("threads_per_sec", (double)(rounds*(uint64_t)threads)*1e9/(double)nsec);
+	hm_bench_u64("mapped_bytes", stats.mapped);
+	hm_bench_u64("spans", stats.spans);
+	hm_bench_end();
+}
+
+/*
+ * larson: each thread replaces random blocks of a shared working set, then
+ * hands the set to a fresh thread, so blocks outlive the thread that made them
+ */
+typedef struct hm_bench_larson_set_s {
+	void** slots;
+	size_t count;
+}hm_bench_larson_set;
+
+static void* hm_bench_larson_worker(void* arg)
+{
+	hm_bench_worker* worker = arg;
+	hm_bench_larson_set* set = worker->shared;
+	uint64_t iters, i, start;
+	size_t index;
+
+	iters = hm_bench_iters(200000);
+	start = hm_bench_now();
+	for(i = 0; i < iters; i ++) {
+		index = (size_t)(hm_bench_rand(&worker->rand)%set->count);
+		hm_bench.alloc->free(set->slots[index]);
+		set->slots[index] = hm_bench.alloc->alloc(hm_bench_size(&worker->rand, 16, 256));
+	}
+	worker->nsec = hm_bench_now()-start;
+	worker->ops = iters;
+	return NULL;
+}
+
+void hm_bench_larson()
+{
+	hm_bench_larson_set* sets;
+	hm_bench_worker* workers;
+	uint64_t ops = 0, nsec = 0;
+	int threads, index, round;
+	uint64_t rand = 1;
+	size_t slot;
+
+	threads = hm_bench.threads;
+	sets = calloc((size_t)threads, sizeof(hm_bench_larson_set));
+	if(!sets)
+		abort();
+	for(index = 0; index < threads; index ++) {
+		sets[index].count = 1000;
+		sets[index].slots = calloc(sets[index].count, sizeof(void* ));
+		if(!sets[index].slots)
+			abort();
+		for(slot = 0; slot < sets[index].count; slot ++)
+			sets[index].slots[slot] = hm_bench.alloc->alloc(hm_bench_size(&rand, 16, 256));
+	}
+
+	for(round = 0; round < 8; round ++) {
+		workers = hm_bench_workers(threads);
+		for(index = 0; index < threads; index ++) {
+			workers[index].rand += (uint64_t)round;
+			workers[index].shared = &sets[(index+round)%threads];
+		}
+		hm_bench_run(threads, hm_bench_larson_worker, workers, sizeof(hm_bench_worker));
+		for(index = 0; index < threads; index ++)
+			ops += workers[index].ops;
+		nsec += hm_bench_elapsed(workers, threads);
+		free(workers);
+	}
+
+	for(index = 0; index < threads; index ++) {
+		for(slot = 0; slot < sets[index].count; slot ++)
+			hm_bench.alloc->free(sets[index].slots[slot]);
+		free(sets[index].slots);
+	}
+	free(sets);
+
+	hm_bench_begin("larson");
+	hm_bench_u64("threads", (uint64_t)threads);
+	hm_bench_f64("ops_per_sec", (double)ops*1e9/(double)(nsec ? nsec : 1));
+	hm_bench_end();
+}
+
+/*
+ * xmalloc: allocating threads push batches onto a shared stack that
+ * freeing threads drain, unlike prodcons any thread may free any batch
+ */
+typedef struct hm_bench_xbatch_s {
+	struct hm_bench_xbatch_s* next;
+	void* ptrs[HM_BENCH_XBATCH];
+}hm_bench_xbatch;
+
+typedef struct hm_bench_xqueue_s {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	hm_bench_xbatch* head;
+	int producers;
+	uint64_t batches;
+}hm_bench_xqueue;
+
+static void* hm_bench_xmalloc_worker(void* arg)
+{
+	hm_bench_worker* worker = arg;
+	hm_bench_xqueue* queue = worker->shared;
+	hm_bench_xbatch* batch;
+	uint64_t i, start;
+	int index;
+
+	start = hm_bench_now();
+	if(!(worker->index&1)) {
+		for(i = 0; i < queue->batches; i ++) {
+			batch = hm_bench.alloc->alloc(sizeof(hm_bench_xbatch));
+			for(index = 0; index < HM_BENCH_XBATCH; index ++)
+				batch->ptrs[index] = hm_bench.alloc->alloc(hm_bench_size(&worker->rand, 16, 512));
+
+			pthread_mutex_lock(&queue->lock);
+			batch->next = queue->head;
+			queue->head = batch;
+			pthread_cond_signal(&queue->cond);
+			pthread_mutex_unlock(&queue->lock);
+		}
+
+		pthread_mutex_lock(&queue->lock);
+		queue->producers --;
+		pthread_cond_broadcast(&queue->cond);
+		pthread_mutex_unlock(&queue->lock);
+		worker->ops = queue->batches*(HM_BENCH_XBATCH+1);
+	}
+	else {
+		for(;;) {
+			pthread_mutex_lock(&queue->lock);
+			while(!queue->head && queue->producers)
+				pthread_cond_wait(&queue->cond, &queue->lock);
+			batch = queue->head;
+			if(batch)
+				queue->head = batch->next;
+			pthread_mutex_unlock(&queue->lock);
+			if(!batch)
+				break;
+
+			for(index = 0; index < HM_BENCH_XBATCH; index ++)
+				hm_bench.alloc->free(batch->ptrs[index]);
+			hm_bench.alloc->free(batch);
+			worker->ops += HM_BENCH_XBATCH+1;
+		}
+	}
+	worker->nsec = hm_bench_now()-start;
+	return NULL;
+}
+
+void hm_bench_xmalloc()
+{
+	hm_bench_worker* workers;
+	hm_bench_xqueue queue;
+	int threads, index;
+
+	threads = hm_bench.threads&~1;
+	if(threads < 2)
+		threads = 2;
+
+	pthread_mutex_init(&queue.lock, NULL);
+	pthread_cond_init(&queue.cond, NULL);
+	queue.head = NULL;
+	queue.producers = threads/2;
+	queue.batches = hm_bench_iters(20000);
+
+	workers = hm_bench_workers(threads);
+	for(index = 0; index < threads; index ++)
+		workers[index].shared = &queue;
+	hm_bench_run(threads, hm_bench_xmalloc_worker, workers, sizeof(hm_bench_worker));
+
+	hm_bench_begin("xmalloc");
+	hm_bench_u64("threads", (uint64_t)threads);
+	hm_bench_f64("ops_per_sec", hm_bench_rate(workers, threads)/2);
+	hm_bench_end();
+
+	free(workers);
+	pthread_cond_destroy(&queue.cond);
+	pthread_mutex_destroy(&queue.lock);
+}
@@ -0,0 +1,169 @@
+#include "hm_def.h"
+#include "hm_osi.h"
+
+#include "hm_mem.h"
+#include "hm_task.h"
+
+#include <stdlib.h>
+
+/* tasks take the shards of a group in turn */
+static u32 hm_budget_next;
+
+void hm_budget_init(hm_budget* budget)
+{
+	memset(budget, 0, sizeof(hm_budget));
+	budget->shard = hm_atomic_add(&hm_budget_next, 1)%HM_BUDGET_SHARDS;
+}
+
+/* what the task holds now moves along with it */
+void hm_budget_join(hm_budget* budget, hm_group* group)
+{
+	if(budget->group)
+		hm_atomic_sub(&budget->group->shards[budget->shard].bytes, budget->bytes);
+	budget->group = group;
+	if(group)
+		hm_atomic_add(&group->shards[budget->shard].bytes, budget->bytes);
+}
+
+static __inline u32 hm_budget_over(hm_budget_limit* limit, s64 usage)
+{
+	u32 over = 0;
+
+	if(limit->soft && usage > (s64)limit->soft)
+		over |= HM_BUDGET_SOFT;
+	if(limit->hard && usage > (s64)limit->hard)
+		over |= HM_BUDGET_HARD;
+	return over;
+}
+
+/* remember what usage is over now, returns the limits newly crossed */
+static __inline u32 hm_budget_cross(hm_budget_limit* limit, u32 over)
+{
+	if(__atomic_load_n(&limit->crossed, __ATOMIC_RELAXED) == over)
+		return 0;
+	return over&~__atomic_exchange_n(&limit->crossed, over, __ATOMIC_RELAXED);
+}
+
+/* worth a flush: a limit not crossed yet, or a hard one */
+static __inline int hm_budget_pressed(hm_budget_limit* limit, u32 over)
+{
+	return !!(over&(HM_BUDGET_HARD|~__atomic_load_n(&limit->crossed, __ATOMIC_RELAXED)));
+}
+
+/*
+ * the cache being refilled goes first, a context flushes into the task's
+ * cache. it is only drained, the refill goes on with its bins.
+ */
+static void hm_budget_flush(hm_budget* budget, hm_mem* mem)
+{
+	hm_task* task = container_of(budget, hm_task, budget);
+
+	if(mem != &task->mem)
+		hm_mem_drain(mem);
+	hm_mem_drain(&task->mem);
+}
+
+/* the usage of the group as far as a charge needs to know */
+static __inline s64 hm_budget_group(hm_budget* budget, hm_group* group, size_t bytes)
+{
+	size_t lowest = group->limit.soft ? group->limit.soft : group->limit.hard;
+	s64 usage;
+
+	if(!lowest)
+		return 0;
+
+	budget->unchecked += (s64)bytes;
+	usage = __atomic_load_n(&group->usage.bytes, __ATOMIC_RELAXED);
+	if(budget->unchecked < HM_BUDGET_SLICE &&
+		usage+(s64)HM_BUDGET_SLICE*HM_BUDGET_SHARDS < (s64)lowest)
+		return usage;
+
+	budget->unchecked = 0;
+	return hm_group_usage(group);
+}
+
+/* before bytes are taken from the manager, -1 if a hard limit holds them back */
+int hm_budget_charge(hm_budget* budget, hm_mem* mem, size_t bytes)
+{
+	hm_group* group = budget->group;
+	s64 usage = 0;
+	u32 over, gover, fresh, gfresh;
+
+	budget->bytes += (s64)bytes;
+	if(group)
+		hm_atomic_add(&group->shards[budget->shard].bytes, (s64)bytes);
+
+	over = hm_budget_over(&budget->limit, budget->bytes);
+	gover = group ? hm_budget_over(&group->limit, hm_budget_group(budget, group, bytes)) : 0;
+	if(hm_likely(!hm_budget_pressed(&budget->limit, over) &&
+		!(group && hm_budget_pressed(&group->limit, gover)))) {
+		/* back under a limit, the next crossing is reported again */
+		hm_budget_cross(&budget->limit, over);
+		if(group)
+			hm_budget_cross(&group->limit, gover);
+		return 0;
+	}
+
+	hm_budget_flush(budget, mem);
+
+	over = hm_budget_over(&budget->limit, budget->bytes);
+	fresh = hm_budget_cross(&budget->limit, over);
+	if(fresh && budget->limit.callback)
+		budget->limit.callback(NULL, fresh, budget->bytes, budget->limit.arg);
+
+	gover = 0;
+	if(group) {
+		usage = hm_group_usage(group);
+		gover = hm_budget_over(&group->limit, usage);
+		gfresh = hm_budget_cross(&group->limit, gover);
+		if(gfresh && group->limit.callback)
+			group->limit.callback(group, gfresh, usage, group->limit.arg);
+	}
+
+	if((over|gover)&HM_BUDGET_HARD) {
+		hm_budget_uncharge(budget, bytes);
+		return -1;
+	}
+	return 0;
+}
+
+void hm_budget_uncharge(hm_budget* budget, size_t bytes)
+{
+	budget->bytes -= (s64)bytes;
+	if(budget->group)
+		hm_atomic_sub(&budget->group->shards[budget->shard].bytes, (s64)bytes);
+}
+
+hm_group* hm_group_create(size_t soft, size_t hard, hm_budget_callback callback, void* arg)
+{
+	hm_group* group;
+
+	group = aligned_alloc(HM_BUDGET_LINE, sizeof(hm_group));
+	if(!group)
+		return NULL;
+
+	memset(group, 0, sizeof(hm_group));
+	group->limit.soft = soft;
+	group->limit.hard = hard;
+	group->limit.callback = callback;
+	group->limit.arg = arg;
+	return group;
+}
+
+/* no task may be left in the group */
+void hm_group_destroy(hm_group* group)
+{
+	free(group);
+}
+
+/* a sum of the shards, tasks keep adding to it meanwhile */
+s64 hm_group_usage(hm_group* group)
+{
+	s64 usage = 0;
+	u32 shard;
+
+	for(shard = 0; shard < HM_BUDGET_SHARDS; shard ++)
+		usage += __atomic_load_n(&group->shards[shard].bytes, __ATOMIC_RELAXED);
+	__atomic_store_n(&group->usage.bytes, usage, __ATOMIC_RELAXED);
+	return usage;
+}
@@ -0,0 +1,35 @@
+#include "hm_def.h"
+#include "hm_osi.h"
+
+#include "hm_task.h"
+#include "hm_ctx.h"
+
+HM_TLS hm_ctx* hm_ctx_local;
+
+hm_ctx* hm_ctx_create()
+{
+	hm_ctx* ctx;
+
+	if(hm_initialize())
+		return NULL;
+
+	ctx = k_malloc(sizeof(hm_ctx));
+	if(!ctx)
+		return NULL;
+
+	if(hm_mem_init(&ctx->mem, HM_CTX_SHIFT, NULL, NULL)) {
+		k_free(ctx);
+		return NULL;
+	}
+	return ctx;
+}
+
+/* its cached blocks go back to the manager, blocks still allocated stay valid */
+void hm_ctx_destroy(hm_ctx* ctx)
+{
+	if(ctx == hm_ctx_local)
+		hm_ctx_switch(NULL);
+
+	hm_mem_release(&ctx->mem);
+	k_free(ctx);
+}
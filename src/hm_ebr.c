@@ -0,0 +1,236 @@
+#define _GNU_SOURCE
+
+#include "hm_def.h"
+#include "hm_osi.h"
+
+#include "hm_mem.h"
+#include "hm_task.h"
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifndef MEMBARRIER_CMD_PRIVATE_EXPEDITED
+#define MEMBARRIER_CMD_PRIVATE_EXPEDITED (1<<3)
+#define MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED (1<<4)
+#endif
+
+/* starts at 1, 0 is the quiescent announcement */
+static u64 hm_ebr_epoch = 1;
+static list_t hm_ebr_tasks = LIST_INIT(hm_ebr_tasks);
+static hm_lock hm_ebr_lock = HM_LOCK_INIT;
+/* limbo of released tasks */
+static hm_ebr_bag* hm_ebr_orphans;
+/* without membarrier the readers pay for the fence themselves */
+static int hm_ebr_fence = 1;
+
+int hm_ebr_initialize()
+{
+	if(!syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0))
+		hm_ebr_fence = 0;
+
+	return 0;
+}
+
+void hm_ebr_init(hm_ebr* ebr)
+{
+	memset(ebr, 0, sizeof(hm_ebr));
+
+	hm_lock_acquire(&hm_ebr_lock);
+	list_add(&ebr->list, &hm_ebr_tasks);
+	hm_lock_release(&hm_ebr_lock);
+}
+
+/* plain loads and stores, the advancing task supplies the barrier */
+static __inline void hm_ebr_announce(hm_ebr* ebr)
+{
+	__atomic_store_n(&ebr->epoch, __atomic_load_n(&hm_ebr_epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+	if(hm_unlikely(hm_ebr_fence))
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	else
+		__atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+
+void hm_ebr_enter()
+{
+	hm_task* task = hm_task_self();
+
+	if(task && !task->ebr.nest ++)
+		hm_ebr_announce(&task->ebr);
+}
+
+void hm_ebr_exit()
+{
+	hm_task* task = hm_task_local;
+
+	if(task && !-- task->ebr.nest)
+		__atomic_store_n(&task->ebr.epoch, 0, __ATOMIC_RELEASE);
+}
+
+void hm_ebr_quiescent()
+{
+	hm_task* task = hm_task_self();
+
+	if(task && !task->ebr.nest)
+		hm_ebr_announce(&task->ebr);
+}
+
+void hm_ebr_offline()
+{
+	hm_task* task = hm_task_local;
+
+	if(task && !task->ebr.nest)
+		__atomic_store_n(&task->ebr.epoch, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * move on once every task inside a critical section has seen this epoch,
+ * orphaned bags that became safe are handed back
+ */
+static u64 hm_ebr_advance(hm_ebr_bag** orphans)
+{
+	hm_ebr_bag *bag, **pos;
+	hm_ebr* ebr;
+	u64 epoch, seen;
+
+	hm_lock_acquire(&hm_ebr_lock);
+	epoch = hm_ebr_epoch;
+	if(!hm_ebr_fence)
+		syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+	else
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	list_for_each_entry(ebr, &hm_ebr_tasks, list) {
+		seen = __atomic_load_n(&ebr->epoch, __ATOMIC_RELAXED);
+		if(seen && seen != epoch)
+			goto out;
+	}
+	__atomic_store_n(&hm_ebr_epoch, ++ epoch, __ATOMIC_RELEASE);
+out:
+	for(pos = &hm_ebr_orphans; (bag = *pos); ) {
+		if(bag->epoch+2 <= epoch) {
+			*pos = bag->next;
+			bag->next = *orphans;
+			*orphans = bag;
+		}
+		else
+			pos = &bag->next;
+	}
+	hm_lock_release(&hm_ebr_lock);
+	return epoch;
+}
+
+/* free a chain of bags through the task cache, so it flushes in batches */
+static void hm_ebr_free(hm_mem* mem, hm_ebr_bag* bag)
+{
+	hm_ebr_bag* next;
+	u32 index;
+
+	for(; bag; bag = next) {
+		next = bag->next;
+		for(index = 0; index < bag->count; index ++)
+			hm_mem_free(mem, bag->ptrs[index]);
+		k_free(bag);
+	}
+}
+
+static void hm_ebr_flush(hm_mem* mem, hm_limbo* limbo)
+{
+	hm_ebr_free(mem, limbo->bags);
+	limbo->bags = NULL;
+	limbo->count = 0;
+}
+
+void hm_free_deferred(void* ptr)
+{
+	hm_task* task;
+	hm_limbo* limbo;
+	hm_ebr_bag* bag;
+	u64 epoch;
+
+	if(hm_unlikely(!ptr))
+		return;
+
+	/* no task means no memory for the bookkeeping either, the block leaks */
+	task = hm_task_self();
+	if(hm_unlikely(!task))
+		return;
+
+	epoch = __atomic_load_n(&hm_ebr_epoch, __ATOMIC_ACQUIRE);
+	limbo = &task->ebr.limbo[epoch%HM_EBR_EPOCHS];
+	/* what the slot holds is at least three epochs old */
+	if(limbo->epoch != epoch) {
+		if(limbo->bags)
+			hm_ebr_flush(&task->mem, limbo);
+		limbo->epoch = epoch;
+	}
+
+	bag = limbo->bags;
+	if(!bag || bag->count == HM_EBR_BAG) {
+		bag = k_malloc(sizeof(hm_ebr_bag));
+		if(!bag)
+			return;
+		bag->next = limbo->bags;
+		bag->count = 0;
+		limbo->bags = bag;
+	}
+	bag->ptrs[bag->count ++] = ptr;
+	limbo->count ++;
+
+	if(++ task->ebr.pending >= HM_EBR_BATCH)
+		hm_ebr_reclaim();
+}
+
+/* try to advance the epoch and free what became safe, returns what is still deferred */
+size_t hm_ebr_reclaim()
+{
+	hm_ebr_bag* orphans;
+	hm_task* task;
+	hm_limbo* limbo;
+	size_t left;
+	u64 epoch;
+	u32 index;
+
+	task = hm_task_self();
+	if(!task)
+		return 0;
+
+	task->ebr.pending = 0;
+	orphans = NULL;
+	epoch = hm_ebr_advance(&orphans);
+	hm_ebr_free(&task->mem, orphans);
+
+	left = 0;
+	for(index = 0; index < HM_EBR_EPOCHS; index ++) {
+		limbo = &task->ebr.limbo[index];
+		if(limbo->bags && limbo->epoch+2 <= epoch)
+			hm_ebr_flush(&task->mem, limbo);
+		left += limbo->count;
+	}
+
+	return left;
+}
+
+/* thread exit, limbo that is not safe yet is left to the other tasks */
+void hm_ebr_release(hm_ebr* ebr)
+{
+	hm_ebr_bag *bag, *next;
+	hm_limbo* limbo;
+	u32 index;
+
+	assert(!ebr->nest);
+
+	hm_lock_acquire(&hm_ebr_lock);
+	list_del(&ebr->list);
+	for(index = 0; index < HM_EBR_EPOCHS; index ++) {
+		limbo = &ebr->limbo[index];
+		for(bag = limbo->bags; bag; bag = next) {
+			next = bag->next;
+			bag->epoch = limbo->epoch;
+			bag->next = hm_ebr_orphans;
+			hm_ebr_orphans = bag;
+		}
+		limbo->bags = NULL;
+		limbo->count = 0;
+	}
+	hm_lock_release(&hm_ebr_lock);
+}
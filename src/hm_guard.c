@@ -0,0 +1,364 @@
+#define _GNU_SOURCE
+
+#include "hm_def.h"
+#include "hm_osi.h"
+
+#include "hm_guard.h"
+
+#include <execinfo.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+/*
+ * sampled allocations get a page of their own in one chunk, laid out as
+ * header, guard, slot, guard, slot, ... guard. they end at the end of the
+ * page so overflows fault right away, freed slots stay inaccessible until
+ * the round robin comes back to them.
+ */
+typedef struct hm_guard_s {
+	hm_lock lock;
+	hm_chunk* chunk;
+	char* pages;
+	u32 slots;
+	u32 cursor;
+	hm_guard_slot* slot;
+	hm_guard_info info;
+	struct sigaction segv;
+	struct sigaction bus;
+}hm_guard;
+
+static hm_guard hm_guard_main = { .lock = HM_LOCK_INIT };
+/* mean allocations between samples, 0 when off */
+static u32 hm_guard_rate;
+static HM_TLS u64 hm_guard_seed;
+
+static u64 hm_guard_rand()
+{
+	u64 x = hm_guard_seed;
+
+	if(hm_unlikely(!x))
+		x = (u64)(uintptr_t)&hm_guard_seed*0x9e3779b97f4a7c15ull|1;
+	x ^= x<<13;
+	x ^= x>>7;
+	x ^= x<<17;
+	return hm_guard_seed = x;
+}
+
+/* allocations until the next sample, uniform around the rate */
+u32 hm_guard_next()
+{
+	u32 rate = hm_guard_rate;
+
+	if(!rate)
+		return HM_GUARD_IDLE;
+	return 1+(u32)(hm_guard_rand()%(2*(u64)rate));
+}
+
+/* for callers that look at every allocation */
+int hm_guard_due()
+{
+	u32 rate = hm_guard_rate;
+
+	return rate && !(hm_guard_rand()%rate);
+}
+
+static void hm_guard_trace_take(hm_guard_trace* trace)
+{
+	trace->tid = (int)syscall(SYS_gettid);
+	trace->depth = backtrace(trace->stack, HM_GUARD_DEPTH);
+}
+
+static __inline char* hm_guard_page(hm_guard* guard, u32 index)
+{
+	return guard->pages+((size_t)(2*index+1)<<HM_PAGE_SHIFT);
+}
+
+/* the reports are written from the fault handler, so no stdio */
+static void hm_guard_puts(const char* str)
+{
+	ssize_t n = write(2, str, strlen(str));
+
+	(void)n;
+}
+
+static void hm_guard_putu(u64 value, int hex)
+{
+	char buf[24], *pos = buf+sizeof(buf);
+	u32 base = hex ? 16 : 10;
+
+	*-- pos = 0;
+	do {
+		*-- pos = "0123456789abcdef"[value%base];
+		value /= base;
+	} while(value);
+	if(hex) {
+		*-- pos = 'x';
+		*-- pos = '0';
+	}
+	hm_guard_puts(pos);
+}
+
+static void hm_guard_trace_print(const char* what, hm_guard_trace* trace)
+{
+	hm_guard_puts(what);
+	hm_guard_puts(" by thread ");
+	hm_guard_putu((u64)trace->tid, 0);
+	hm_guard_puts(":\n");
+	backtrace_symbols_fd(trace->stack, trace->depth, 2);
+}
+
+static void hm_guard_report(const char* what, const void* addr, hm_guard_slot* slot)
+{
+	hm_guard_puts("hotmem: ");
+	hm_guard_puts(what);
+	hm_guard_puts(" at ");
+	hm_guard_putu((uintptr_t)addr, 1);
+	if(slot && slot->ptr) {
+		hm_guard_puts(", ");
+		if((const char* )addr < slot->ptr) {
+			hm_guard_putu((u64)(slot->ptr-(const char* )addr), 0);
+			hm_guard_puts(" bytes before");
+		}
+		else if((const char* )addr >= slot->ptr+slot->size) {
+			hm_guard_putu((u64)((const char* )addr-slot->ptr-slot->size), 0);
+			hm_guard_puts(" bytes past");
+		}
+		else {
+			hm_guard_putu((u64)((const char* )addr-slot->ptr), 0);
+			hm_guard_puts(" bytes into");
+		}
+		hm_guard_puts(" a ");
+		hm_guard_putu(slot->size, 0);
+		hm_guard_puts(" byte allocation at ");
+		hm_guard_putu((uintptr_t)slot->ptr, 1);
+	}
+	hm_guard_puts("\n");
+
+	if(slot && slot->state != HM_GUARD_FREE)
+		hm_guard_trace_print("allocated", &slot->alloc);
+	if(slot && slot->state == HM_GUARD_FREED)
+		hm_guard_trace_print("freed", &slot->free);
+}
+
+/* what a fault at addr inside the guard chunk hit */
+static void hm_guard_explain(hm_guard* guard, const char* addr)
+{
+	hm_guard_slot* slot;
+	size_t page;
+	u32 index;
+
+	page = (size_t)(addr-guard->pages)>>HM_PAGE_SHIFT;
+	index = (u32)(page>>1);
+	if(page&1) {
+		slot = &guard->slot[index];
+		hm_guard_report(slot->state == HM_GUARD_FREED ? "use-after-free" : "wild access", addr, slot);
+		return;
+	}
+
+	/* a guard page, blame the closer of its two neighbours */
+	if(((uintptr_t)addr&(HM_PAGE_SIZE-1)) < HM_PAGE_SIZE/2 && index > 0) {
+		slot = &guard->slot[index-1];
+		hm_guard_report(slot->state == HM_GUARD_FREED ? "use-after-free" : "buffer-overflow", addr, slot);
+	}
+	else if(index < guard->slots) {
+		slot = &guard->slot[index];
+		hm_guard_report(slot->state == HM_GUARD_FREED ? "use-after-free" : "buffer-underflow", addr, slot);
+	}
+	else
+		hm_guard_report("wild access", addr, NULL);
+}
+
+static void hm_guard_fault(int sig, siginfo_t* info, void* context)
+{
+	hm_guard* guard = &hm_guard_main;
+	struct sigaction* prev;
+	char* addr = info->si_addr;
+
+	prev = sig == SIGBUS ? &guard->bus : &guard->segv;
+	if(addr >= guard->pages && addr < (char* )guard->chunk+HM_CHUNK_SIZE) {
+		hm_guard_explain(guard, addr);
+		/* the faulting access runs again and crashes as it would have */
+		sigaction(sig, prev, NULL);
+		return;
+	}
+
+	if(prev->sa_flags&SA_SIGINFO)
+		prev->sa_sigaction(sig, info, context);
+	else if(prev->sa_handler != SIG_DFL && prev->sa_handler != SIG_IGN)
+		prev->sa_handler(sig);
+	else
+		sigaction(sig, prev, NULL);
+}
+
+/* HOTMEM_GUARD=rate[,slots] turns sampling on at startup */
+int hm_guard_initialize()
+{
+	const char* env = getenv("HOTMEM_GUARD");
+	unsigned long rate, slots;
+	char* end;
+
+	if(!env || !*env)
+		return 0;
+
+	rate = strtoul(env, &end, 10);
+	slots = *end == ',' ? strtoul(end+1, NULL, 10) : 0;
+	if(!rate)
+		return 0;
+
+	return hm_guard_enable((u32)rate, (u32)slots);
+}
+
+/* one in rate allocations on average, slots 0 takes as many as fit */
+int hm_guard_enable(u32 rate, u32 slots)
+{
+	hm_guard* guard = &hm_guard_main;
+	struct sigaction action;
+	hm_chunk* chunk;
+	void* warm[1];
+
+	if(!rate)
+		return -1;
+
+	hm_lock_acquire(&guard->lock);
+	if(!guard->chunk) {
+		if(!slots || slots > HM_GUARD_SLOTS_MAX)
+			slots = HM_GUARD_SLOTS_MAX;
+
+		guard->slot = k_malloc(slots*sizeof(hm_guard_slot));
+		chunk = hm_os_map_aligned(HM_CHUNK_SIZE, HM_CHUNK_SIZE);
+		if(!guard->slot || !chunk) {
+			if(chunk)
+				hm_os_unmap(chunk, HM_CHUNK_SIZE);
+			k_free(guard->slot);
+			guard->slot = NULL;
+			hm_lock_release(&guard->lock);
+			return -1;
+		}
+		memset(guard->slot, 0, slots*sizeof(hm_guard_slot));
+
+		chunk->magic = HM_CHUNK_MAGIC;
+		chunk->kind = HM_CHUNK_GUARD;
+		chunk->mgr = &hm_mgr_main;
+		chunk->size = HM_CHUNK_SIZE;
+		guard->pages = (char* )chunk+HM_CHUNK_HEADER;
+		hm_os_protect(guard->pages, HM_CHUNK_SIZE-HM_CHUNK_HEADER, 0);
+		guard->slots = slots;
+		guard->info.slots = slots;
+
+		/* backtrace loads its unwinder on first use, better here than mid allocation */
+		backtrace(warm, 1);
+
+		memset(&action, 0, sizeof(action));
+		action.sa_sigaction = hm_guard_fault;
+		action.sa_flags = SA_SIGINFO|SA_ONSTACK;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGSEGV, &action, &guard->segv);
+		sigaction(SIGBUS, &action, &guard->bus);
+
+		hm_atomic_store(&guard->chunk, chunk);
+	}
+	hm_lock_release(&guard->lock);
+
+	hm_atomic_store(&hm_guard_rate, rate);
+	/* the caller samples from its next allocation on, other threads within HM_GUARD_IDLE */
+	hm_pool_countdown = 1;
+	return 0;
+}
+
+/* sampled blocks stay valid, new allocations are no longer sampled */
+void hm_guard_disable()
+{
+	hm_atomic_store(&hm_guard_rate, 0);
+}
+
+void* hm_guard_alloc(size_t size)
+{
+	hm_guard* guard = &hm_guard_main;
+	hm_guard_trace trace;
+	hm_guard_slot* slot;
+	char* page;
+	u32 index, n;
+
+	if(!hm_guard_rate || size > HM_PAGE_SIZE || !hm_atomic_load(&guard->chunk))
+		return NULL;
+	if(!size)
+		size = 1;
+
+	hm_guard_trace_take(&trace);
+	hm_lock_acquire(&guard->lock);
+	for(n = 0; n < guard->slots; n ++) {
+		index = guard->cursor;
+		guard->cursor = (index+1)%guard->slots;
+		if(guard->slot[index].state != HM_GUARD_LIVE)
+			break;
+	}
+	page = hm_guard_page(guard, index);
+	if(n == guard->slots || hm_os_protect(page, HM_PAGE_SIZE, 1)) {
+		guard->info.full ++;
+		hm_lock_release(&guard->lock);
+		return NULL;
+	}
+
+	slot = &guard->slot[index];
+	slot->ptr = page+HM_PAGE_SIZE-hm_align_up(size, HM_ALIGN);
+	slot->size = size;
+	slot->alloc = trace;
+	slot->free.depth = 0;
+	slot->state = HM_GUARD_LIVE;
+	guard->info.sampled ++;
+	guard->info.live ++;
+	hm_lock_release(&guard->lock);
+
+	return slot->ptr;
+}
+
+static hm_guard_slot* hm_guard_slot_of(hm_guard* guard, const void* ptr)
+{
+	size_t page = (size_t)((const char* )ptr-guard->pages)>>HM_PAGE_SHIFT;
+
+	if(!(page&1) || (page>>1) >= guard->slots)
+		return NULL;
+	return &guard->slot[page>>1];
+}
+
+/* double and invalid frees of sampled blocks are reported and abort */
+void hm_guard_free(void* ptr)
+{
+	hm_guard* guard = &hm_guard_main;
+	hm_guard_trace trace;
+	hm_guard_slot* slot;
+
+	hm_guard_trace_take(&trace);
+	hm_lock_acquire(&guard->lock);
+	slot = hm_guard_slot_of(guard, ptr);
+	if(!slot || slot->state != HM_GUARD_LIVE || slot->ptr != ptr) {
+		hm_lock_release(&guard->lock);
+		hm_guard_report(slot && slot->state == HM_GUARD_FREED && slot->ptr == ptr ?
+			"double-free" : "invalid-free", ptr, slot);
+		if(slot && slot->state == HM_GUARD_FREED)
+			hm_guard_trace_print("freed again", &trace);
+		abort();
+	}
+
+	slot->free = trace;
+	slot->state = HM_GUARD_FREED;
+	guard->info.live --;
+	hm_os_protect(hm_guard_page(guard, (u32)(slot-guard->slot)), HM_PAGE_SIZE, 0);
+	hm_os_purge(hm_guard_page(guard, (u32)(slot-guard->slot)), HM_PAGE_SIZE);
+	hm_lock_release(&guard->lock);
+}
+
+size_t hm_guard_usable_size(const void* ptr)
+{
+	return HM_PAGE_SIZE-((uintptr_t)ptr&(HM_PAGE_SIZE-1));
+}
+
+void hm_guard_stats(hm_guard_info* info)
+{
+	hm_guard* guard = &hm_guard_main;
+
+	hm_lock_acquire(&guard->lock);
+	*info = guard->info;
+	hm_lock_release(&guard->lock);
+}
@@ -0,0 +1,602 @@
+#include "hm_def.h"
+#include "hm_osi.h"
+
+#include "hm_mem.h"
+#include "hm_task.h"
+#include "hm_guard.h"
+
+HM_TLS hm_mem* hm_mem_local;
+static u32 hm_mem_trims;
+
+/* the bins of a light cache before its first use, max 0 sends frees to the slow path */
+static const hm_bin hm_mem_none[HM_CLASS_MAX];
+
+static __inline hm_mem* hm_mem_self()
+{
+	hm_mem* mem = hm_mem_local;
+
+	if(hm_likely(mem))
+		return mem;
+	if(!hm_task_attach())
+		return NULL;
+	return hm_mem_local;
+}
+
+static int hm_ready;
+static hm_lock hm_ready_lock = HM_LOCK_INIT;
+
+static int hm_setup()
+{
+	if(hm_pool_initialize())
+		return -1;
+	if(hm_mgr_init(&hm_mgr_main))
+		return -1;
+	if(hm_ebr_initialize())
+		return -1;
+	if(hm_guard_initialize())
+		return -1;
+
+	return hm_task_initialize();
+}
+
+/*
+ * runs once, on the first allocation if nobody called it before. until then
+ * the globals hold their constant initializers, see hm_pool_sizes.
+ */
+int hm_initialize()
+{
+	int ret = 0;
+
+	if(hm_likely(hm_atomic_load(&hm_ready)))
+		return 0;
+
+	hm_lock_acquire(&hm_ready_lock);
+	if(!hm_ready) {
+		ret = hm_setup();
+		if(!ret)
+			hm_atomic_store(&hm_ready, 1);
+	}
+	hm_lock_release(&hm_ready_lock);
+
+	return ret;
+}
+
+/* what a cache takes from or gives back to the manager is charged to the task running it */
+static __inline hm_budget* hm_mem_budget(hm_mem* mem)
+{
+	hm_task* task = mem->shift ? hm_task_local : container_of(mem, hm_task, mem);
+
+	return task ? &task->budget : NULL;
+}
+
+static void hm_mem_flush_remote(hm_mem* mem, u32 klass)
+{
+	hm_bin* bin = &mem->remote[klass];
+	hm_budget* budget = hm_mem_budget(mem);
+
+	if(budget)
+		hm_budget_uncharge(budget, (size_t)bin->count*hm_pool_sizes[klass]);
+	hm_mgr_flush(mem->mgr, klass, bin->head);
+	bin->head = NULL;
+	bin->count = 0;
+}
+
+static __inline u32 hm_mem_batch(hm_mem* mem, u32 klass)
+{
+	u32 batch = mem->mgr->arenas[mem->node].classes[klass].batch>>mem->shift;
+
+	return batch ? batch : 1;
+}
+
+/* light caches sit on the cache of the task whose thread runs them */
+static __inline hm_mem* hm_mem_parent(hm_mem* mem)
+{
+	hm_task* task = hm_task_local;
+
+	if(!mem->shift || !task || task->mem.node != mem->node)
+		return NULL;
+	return &task->mem;
+}
+
+static void* hm_mem_refill(hm_mem* mem, u32 klass);
+
+static __inline int hm_mem_bare(hm_mem* mem)
+{
+	return mem->bins == (hm_bin* )hm_mem_none;
+}
+
+/* bins of a light cache, only as many as there are classes */
+static int hm_mem_grow(hm_mem* mem)
+{
+	hm_bin* bins;
+	u32 klass;
+
+	bins = k_malloc(hm_pool_classes*sizeof(hm_bin));
+	if(!bins)
+		return -1;
+	memset(bins, 0, hm_pool_classes*sizeof(hm_bin));
+	for(klass = 1; klass < hm_pool_classes; klass ++)
+		bins[klass].max = hm_mem_batch(mem, klass)*2;
+
+	mem->bins = bins;
+	return 0;
+}
+
+/* bins and remote hold HM_CLASS_MAX entries, both NULL makes a light cache */
+int hm_mem_init(hm_mem* mem, u32 shift, hm_bin* bins, hm_bin* remote)
+{
+	u32 klass;
+
+	memset(mem, 0, sizeof(hm_mem));
+	mem->mgr = &hm_mgr_main;
+	mem->node = hm_mgr_node(mem->mgr);
+	mem->shift = shift;
+	mem->trim = hm_atomic_load(&hm_mem_trims);
+	mem->bins = bins ? bins : (hm_bin* )hm_mem_none;
+	mem->remote = remote;
+	if(!remote)
+		return 0;
+
+	memset(bins, 0, HM_CLASS_MAX*sizeof(hm_bin));
+	memset(remote, 0, HM_CLASS_MAX*sizeof(hm_bin));
+	for(klass = 1; klass < hm_pool_classes; klass ++) {
+		bins[klass].max = hm_mem_batch(mem, klass)*2;
+		remote[klass].max = bins[klass].max>>1;
+	}
+
+	return 0;
+}
+
+/* every cached block goes back, the bins stay */
+void hm_mem_drain(hm_mem* mem)
+{
+	u32 klass;
+
+	if(hm_mem_bare(mem))
+		return;
+
+	for(klass = 1; klass < hm_pool_classes; klass ++) {
+		if(mem->bins[klass].count)
+			hm_mem_flush(mem, klass, mem->bins[klass].count);
+		if(mem->remote && mem->remote[klass].count)
+			hm_mem_flush_remote(mem, klass);
+	}
+}
+
+void hm_mem_release(hm_mem* mem)
+{
+	hm_mem_drain(mem);
+	if(!mem->remote && !hm_mem_bare(mem)) {
+		k_free(mem->bins);
+		mem->bins = (hm_bin* )hm_mem_none;
+	}
+}
+
+/* move the task to the node it runs on now, its cached blocks go home */
+int hm_mem_rebind(hm_mem* mem)
+{
+	u32 node = hm_mgr_node(mem->mgr);
+
+	if(node == mem->node)
+		return 0;
+
+	hm_mem_release(mem);
+	mem->node = node;
+	return 1;
+}
+
+/*
+ * drain the caches of the caller and give the free spans back to the os.
+ * other tasks drain theirs on their next refill.
+ */
+size_t hm_mem_trim()
+{
+	hm_task* task = hm_task_local;
+	hm_mem* mem = hm_mem_local;
+	u32 trim;
+
+	trim = hm_atomic_add(&hm_mem_trims, 1);
+	if(mem && (!task || mem != &task->mem)) {
+		mem->trim = trim;
+		hm_mem_release(mem);
+	}
+	if(task) {
+		task->mem.trim = trim;
+		hm_mem_release(&task->mem);
+	}
+
+	return hm_mgr_trim(&hm_mgr_main);
+}
+
+/* hand the first count blocks of a bin back to the manager, or to the parent cache */
+void hm_mem_flush(hm_mem* mem, u32 klass, u32 count)
+{
+	hm_bin* bin = &mem->bins[klass];
+	void *head, *tail;
+	hm_budget* budget;
+	hm_mem* parent;
+	u32 n;
+
+	head = tail = bin->head;
+	for(n = 1; n < count; n ++)
+		tail = *(void** )tail;
+
+	bin->head = *(void** )tail;
+	bin->count -= count;
+
+	parent = hm_mem_parent(mem);
+	if(parent) {
+		bin = &parent->bins[klass];
+		*(void** )tail = bin->head;
+		bin->head = head;
+		bin->count += count;
+		if(bin->count > bin->max)
+			hm_mem_flush(parent, klass, bin->count>>1);
+		return;
+	}
+	*(void** )tail = NULL;
+
+	budget = hm_mem_budget(mem);
+	if(budget)
+		hm_budget_uncharge(budget, (size_t)count*hm_pool_sizes[klass]);
+	hm_mgr_flush(mem->mgr, klass, head);
+}
+
+/* up to count blocks from the manager, charged to the budget beforehand */
+static u32 hm_mem_obtain(hm_mem* mem, u32 klass, void** head, u32 count)
+{
+	hm_budget* budget = hm_mem_budget(mem);
+	size_t size = hm_pool_sizes[klass];
+	u32 n;
+
+	if(budget && hm_budget_charge(budget, mem, count*size))
+		return 0;
+
+	n = hm_mgr_refill(mem->mgr, mem->node, klass, head, count);
+	if(budget && n < count)
+		hm_budget_uncharge(budget, (count-n)*size);
+	return n;
+}
+
+/*
+ * fill the bins to bytes[klass] with resident blocks, so the first
+ * allocations neither refill nor fault. bins keep at least that much.
+ */
+int hm_mem_reserve(hm_mem* mem, const size_t* bytes, u32 flags)
+{
+	size_t total, count, per;
+	u32 klass, size, n;
+	hm_bin* bin;
+	char *block, *pos;
+
+	total = 0;
+	for(klass = 1; klass < hm_pool_classes; klass ++) {
+		size = hm_pool_sizes[klass];
+		per = HM_SPAN_SIZE/size;
+		total += (bytes[klass]+size*per-1)/(size*per)*HM_SPAN_SIZE;
+	}
+	if(!total)
+		return 0;
+	if(hm_mgr_prefault(mem->mgr, mem->node, total, flags))
+		return -1;
+
+	for(klass = 1; klass < hm_pool_classes; klass ++) {
+		size = hm_pool_sizes[klass];
+		count = (bytes[klass]+size-1)/size;
+		bin = &mem->bins[klass];
+		if(bin->max < count)
+			bin->max = (u32)count;
+
+		while(bin->count < count) {
+			n = hm_mem_obtain(mem, klass, &bin->head, (u32)(count-bin->count));
+			if(!n)
+				return -1;
+			bin->count += n;
+		}
+
+		/* pages of a block past the first one were not touched by the refill */
+		if(size <= HM_PAGE_SIZE)
+			continue;
+		for(block = bin->head; block; block = *(char** )block) {
+			pos = (char* )hm_align_up((uintptr_t)block+1, HM_PAGE_SIZE);
+			for(; pos < block+size; pos += HM_PAGE_SIZE)
+				*pos = 0;
+		}
+	}
+
+	return 0;
+}
+
+/* up to count blocks from the bin of a parent cache, NULL terminated */
+static u32 hm_mem_take(hm_mem* mem, u32 klass, void** head, u32 count)
+{
+	hm_bin* bin = &mem->bins[klass];
+	void *block, *tail;
+	u32 n;
+
+	if(!bin->count) {
+		block = hm_mem_refill(mem, klass);
+		if(!block)
+			return 0;
+		*(void** )block = bin->head;
+		bin->head = block;
+		bin->count ++;
+	}
+
+	if(count > bin->count)
+		count = bin->count;
+	block = tail = bin->head;
+	for(n = 1; n < count; n ++)
+		tail = *(void** )tail;
+
+	bin->head = *(void** )tail;
+	bin->count -= count;
+	*(void** )tail = NULL;
+	*head = block;
+	return count;
+}
+
+static void* hm_mem_refill(hm_mem* mem, u32 klass)
+{
+	void *head = NULL, *rest;
+	hm_budget* budget;
+	hm_mem* parent;
+	hm_bin* bin;
+	u32 n, batch;
+
+	/* the refill is where a migrated task notices, and where it hears of a trim */
+	if(mem->mgr->nodes > 1)
+		hm_mem_rebind(mem);
+	if(hm_unlikely(mem->trim != hm_atomic_load(&hm_mem_trims))) {
+		mem->trim = hm_atomic_load(&hm_mem_trims);
+		hm_mem_release(mem);
+	}
+
+	/* a light cache that gets no bins still gets its block */
+	batch = hm_mem_batch(mem, klass);
+	if(hm_unlikely(hm_mem_bare(mem)) && hm_mem_grow(mem))
+		batch = 1;
+
+	parent = hm_mem_parent(mem);
+	if(parent)
+		n = hm_mem_take(parent, klass, &head, batch);
+	else
+		n = hm_mem_obtain(mem, klass, &head, batch);
+	if(!n)
+		return NULL;
+
+	if(n == 1)
+		return head;
+
+	/*
+	 * bins are read again, obtain may have dropped them. without any the
+	 * rest goes back to the manager, otherwise the bin is empty here.
+	 */
+	rest = *(void** )head;
+	*(void** )head = NULL;
+	if(hm_unlikely(hm_mem_bare(mem))) {
+		budget = hm_mem_budget(mem);
+		if(budget)
+			hm_budget_uncharge(budget, (size_t)(n-1)*hm_pool_sizes[klass]);
+		hm_mgr_flush(mem->mgr, klass, rest);
+		return head;
+	}
+	bin = &mem->bins[klass];
+	bin->head = rest;
+	bin->count = n-1;
+	return head;
+}
+
+static void* hm_mem_alloc_large(hm_mem* mem, size_t size)
+{
+	hm_budget* budget = hm_mem_budget(mem);
+	void* ptr;
+
+	ptr = hm_mgr_alloc_large(mem->mgr, mem->node, size);
+	if(!ptr || !budget)
+		return ptr;
+
+	if(hm_budget_charge(budget, mem, hm_mgr_usable_size(ptr))) {
+		hm_mgr_free_large(mem->mgr, hm_chunk_of(ptr));
+		return NULL;
+	}
+	return ptr;
+}
+
+void* hm_mem_alloc(hm_mem* mem, size_t size)
+{
+	hm_bin* bin;
+	void* ptr;
+	u32 klass;
+
+	if(hm_unlikely(size > HM_SMALL_MAX))
+		return hm_mem_alloc_large(mem, size);
+
+	klass = hm_pool_class(size);
+	bin = &mem->bins[klass];
+	ptr = bin->head;
+	if(hm_likely(ptr)) {
+		bin->head = *(void** )ptr;
+		bin->count --;
+		return ptr;
+	}
+
+	return hm_mem_refill(mem, klass);
+}
+
+/* a light cache batches them in the cache of the task running it */
+static void hm_mem_free_remote(hm_mem* mem, u32 klass, void* ptr)
+{
+	hm_task* task = hm_task_local;
+	hm_bin* bin;
+
+	if(!mem->remote) {
+		if(!task) {
+			*(void** )ptr = NULL;
+			hm_mgr_flush(mem->mgr, klass, ptr);
+			return;
+		}
+		mem = &task->mem;
+	}
+
+	bin = &mem->remote[klass];
+	*(void** )ptr = bin->head;
+	bin->head = ptr;
+	if(++ bin->count >= bin->max)
+		hm_mem_flush_remote(mem, klass);
+}
+
+/* the bin is over its max, or a light cache has no bins yet */
+static void hm_mem_free_full(hm_mem* mem, u32 klass, void* ptr)
+{
+	hm_budget* budget;
+	hm_mem* parent;
+	hm_bin* bin;
+
+	if(hm_mem_bare(mem) && hm_mem_grow(mem)) {
+		parent = hm_mem_parent(mem);
+		if(parent) {
+			hm_mem_free(parent, ptr);
+			return;
+		}
+		*(void** )ptr = NULL;
+		budget = hm_mem_budget(mem);
+		if(budget)
+			hm_budget_uncharge(budget, hm_pool_sizes[klass]);
+		hm_mgr_flush(mem->mgr, klass, ptr);
+		return;
+	}
+
+	bin = &mem->bins[klass];
+	*(void** )ptr = bin->head;
+	bin->head = ptr;
+	if(++ bin->count > bin->max)
+		hm_mem_flush(mem, klass, bin->count>>1);
+}
+
+void hm_mem_free(hm_mem* mem, void* ptr)
+{
+	hm_chunk* chunk = hm_chunk_of(ptr);
+	hm_budget* budget;
+	hm_bin* bin;
+	u32 klass;
+
+	assert(chunk->magic == HM_CHUNK_MAGIC);
+	if(hm_unlikely(chunk->kind != HM_CHUNK_POOL || chunk->mgr != mem->mgr)) {
+		budget = chunk->kind == HM_CHUNK_LARGE && chunk->mgr == mem->mgr ? hm_mem_budget(mem) : NULL;
+		if(budget)
+			hm_budget_uncharge(budget, hm_mgr_usable_size(ptr));
+		hm_mgr_free(chunk->mgr, ptr);
+		return;
+	}
+
+	klass = hm_chunk_pool(chunk, ptr)->klass;
+	if(hm_unlikely(chunk->node != mem->node)) {
+		hm_mem_free_remote(mem, klass, ptr);
+		return;
+	}
+
+	bin = &mem->bins[klass];
+	if(hm_unlikely(bin->count >= bin->max)) {
+		hm_mem_free_full(mem, klass, ptr);
+		return;
+	}
+	*(void** )ptr = bin->head;
+	bin->head = ptr;
+	bin->count ++;
+}
+
+static __inline void* hm_malloc_cached(size_t size)
+{
+	hm_mem* mem = hm_mem_self();
+
+	if(hm_unlikely(!mem))
+		return hm_mgr_alloc(&hm_mgr_main, size);
+	return hm_mem_alloc(mem, size);
+}
+
+/* taken once per hm_pool_countdown allocations */
+static __attribute__((noinline)) void* hm_malloc_sampled(size_t size)
+{
+	void* ptr;
+	int guard;
+
+	if(hm_pool_profiling) {
+		hm_pool_record(size);
+		hm_pool_countdown = 1;
+		guard = hm_guard_due();
+	}
+	else {
+		hm_pool_countdown = hm_guard_next();
+		guard = 1;
+	}
+
+	if(guard && (ptr = hm_guard_alloc(size)))
+		return ptr;
+	return hm_malloc_cached(size);
+}
+
+void* hm_malloc(size_t size)
+{
+	if(hm_unlikely(!-- hm_pool_countdown))
+		return hm_malloc_sampled(size);
+
+	return hm_malloc_cached(size);
+}
+
+void* hm_calloc(size_t count, size_t size)
+{
+	size_t total;
+	void* ptr;
+
+	if(__builtin_mul_overflow(count, size, &total))
+		return NULL;
+
+	ptr = hm_malloc(total);
+	if(ptr)
+		memset(ptr, 0, total);
+	return ptr;
+}
+
+void* hm_realloc(void* ptr, size_t size)
+{
+	size_t usable;
+	void* block;
+
+	if(!ptr)
+		return hm_malloc(size);
+
+	usable = hm_usable_size(ptr);
+	if(size <= usable && size >= (usable>>1))
+		return ptr;
+
+	block = hm_malloc(size);
+	if(block) {
+		memcpy(block, ptr, size < usable ? size : usable);
+		hm_free(ptr);
+	}
+	return block;
+}
+
+void hm_free(void* ptr)
+{
+	hm_mem* mem;
+
+	if(hm_unlikely(!ptr))
+		return;
+
+	mem = hm_mem_self();
+	if(hm_unlikely(!mem)) {
+		hm_mgr_free(hm_chunk_of(ptr)->mgr, ptr);
+		return;
+	}
+	hm_mem_free(mem, ptr);
+}
+
+size_t hm_usable_size(const void* ptr)
+{
+	if(!ptr)
+		return 0;
+
+	return hm_mgr_usable_size(ptr);
+}
@@ -0,0 +1,737 @@
+#include "hm_def.h"
+#include "hm_osi.h"
+
+#include "hm_mgr.h"
+#include "hm_guard.h"
+
+hm_mgr hm_mgr_main;
+
+static void hm_arena_init(hm_arena* arena, u32 node)
+{
+	u32 klass, batch, bin;
+	hm_class* cls;
+
+	hm_lock_init(&arena->lock);
+	arena->node = node;
+	list_init(&arena->chunks);
+	list_init(&arena->dirty);
+	list_init(&arena->clean);
+	list_init(&arena->pinned);
+	for(klass = 0; klass < HM_LARGE_BUCKETS; klass ++)
+		list_init(&arena->large[klass]);
+
+	for(klass = 0; klass < hm_pool_classes; klass ++) {
+		cls = &arena->classes[klass];
+		hm_lock_init(&cls->lock);
+		for(bin = 0; bin < HM_CLASS_BINS; bin ++)
+			list_init(&cls->pools[bin]);
+
+		batch = klass ? HM_BATCH_BYTES/hm_pool_sizes[klass] : 0;
+		if(batch < HM_BATCH_MIN)
+			batch = HM_BATCH_MIN;
+		if(batch > HM_BATCH_MAX)
+			batch = HM_BATCH_MAX;
+		cls->batch = batch;
+	}
+}
+
+int hm_mgr_init(hm_mgr* mgr)
+{
+	u32 node;
+
+	memset(mgr, 0, sizeof(hm_mgr));
+	mgr->nodes = hm_os_nodes();
+	if(mgr->nodes > HM_NODE_MAX)
+		mgr->nodes = HM_NODE_MAX;
+
+	for(node = 0; node < mgr->nodes; node ++)
+		hm_arena_init(&mgr->arenas[node], node);
+
+	return 0;
+}
+
+/* one arena whose chunks all come from base, which is aligned to a chunk */
+int hm_mgr_init_range(hm_mgr* mgr, void* base, size_t size)
+{
+	if((uintptr_t)base&HM_CHUNK_MASK)
+		return -1;
+
+	memset(mgr, 0, sizeof(hm_mgr));
+	mgr->nodes = 1;
+	mgr->base = base;
+	mgr->size = hm_align_down(size, HM_CHUNK_SIZE);
+	hm_arena_init(&mgr->arenas[0], 0);
+	return 0;
+}
+
+/* length is a multiple of the chunk size when the manager has a range */
+static void* hm_mgr_map(hm_mgr* mgr, size_t length)
+{
+	size_t used;
+
+	if(!mgr->base)
+		return hm_os_map_aligned(length, HM_CHUNK_SIZE);
+
+	used = __atomic_load_n(&mgr->used, __ATOMIC_RELAXED);
+	do {
+		if(length > mgr->size-used)
+			return NULL;
+	} while(!__atomic_compare_exchange_n(&mgr->used, &used, used+length, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	return mgr->base+used;
+}
+
+/* arena of the node the caller runs on */
+u32 hm_mgr_node(hm_mgr* mgr)
+{
+	if(mgr->nodes == 1)
+		return 0;
+
+	return hm_os_node()%mgr->nodes;
+}
+
+/* called with arena->lock held */
+static int hm_mgr_chunk_map(hm_mgr* mgr, hm_arena* arena)
+{
+	hm_chunk* chunk;
+	hm_pool* pool;
+	u32 index;
+
+	chunk = hm_mgr_map(mgr, HM_CHUNK_SIZE);
+	if(!chunk)
+		return -1;
+
+	/* before the header write faults in the first page */
+	if(mgr->nodes > 1)
+		hm_os_bind(chunk, HM_CHUNK_SIZE, arena->node);
+
+	chunk->magic = HM_CHUNK_MAGIC;
+	chunk->kind = HM_CHUNK_POOL;
+	chunk->node = arena->node;
+	chunk->mgr = mgr;
+	chunk->size = HM_CHUNK_SIZE;
+	chunk->clean = HM_CHUNK_SPANS-1;
+	list_add_tail(&chunk->list, &arena->chunks);
+
+	/* span 0 holds the header */
+	for(index = 1; index < HM_CHUNK_SPANS; index ++) {
+		pool = &chunk->pools[index];
+		pool->base = (char* )chunk+((size_t)index<<HM_SPAN_SHIFT);
+		pool->flags = HM_POOL_PURGED;
+		list_add_tail(&pool->list, &arena->clean);
+	}
+
+	arena->stats.mapped += HM_CHUNK_SIZE;
+	arena->stats.spans_clean += HM_CHUNK_SPANS-1;
+	return 0;
+}
+
+/* pinned and recently released spans are still faulted in, prefer them */
+static hm_pool* hm_mgr_span_alloc(hm_mgr* mgr, hm_arena* arena)
+{
+	list_t* pos;
+
+	hm_lock_acquire(&arena->lock);
+	if(!list_empty(&arena->pinned)) {
+		pos = arena->pinned.next;
+		arena->stats.spans_pinned --;
+	}
+	else if(!list_empty(&arena->dirty)) {
+		pos = arena->dirty.next;
+		arena->stats.spans_dirty --;
+		if(arena->reserve)
+			arena->reserve --;
+	}
+	else {
+		if(list_empty(&arena->clean) && hm_mgr_chunk_map(mgr, arena)) {
+			hm_lock_release(&arena->lock);
+			return NULL;
+		}
+		pos = arena->clean.next;
+		hm_chunk_of(pos)->clean --;
+		arena->stats.spans_clean --;
+	}
+	list_del_init(pos);
+	arena->stats.spans ++;
+	hm_lock_release(&arena->lock);
+
+	return list_entry(pos, hm_pool, list);
+}
+
+/* called with arena->lock held, an explicit keep below the reserve cuts it */
+static void hm_mgr_purge_locked(hm_arena* arena, size_t keep)
+{
+	hm_pool* pool;
+
+	while(arena->stats.spans_dirty > keep) {
+		pool = list_last_entry(&arena->dirty, hm_pool, list);
+		list_del(&pool->list);
+		hm_os_purge(pool->base, HM_SPAN_SIZE);
+		flag_set(pool, HM_POOL_PURGED);
+		list_add(&pool->list, &arena->clean);
+		hm_chunk_of(pool->base)->clean ++;
+		arena->stats.spans_dirty --;
+		arena->stats.spans_clean ++;
+	}
+	if(arena->reserve > arena->stats.spans_dirty)
+		arena->reserve = arena->stats.spans_dirty;
+}
+
+static void hm_mgr_span_release(hm_arena* arena, hm_pool* pool)
+{
+	pool->klass = 0;
+	flag_unset(pool, HM_POOL_PURGED);
+
+	hm_lock_acquire(&arena->lock);
+	if(flag_test(pool, HM_POOL_PINNED)) {
+		list_add(&pool->list, &arena->pinned);
+		arena->stats.spans --;
+		arena->stats.spans_pinned ++;
+		hm_lock_release(&arena->lock);
+		return;
+	}
+
+	list_add(&pool->list, &arena->dirty);
+	arena->stats.spans --;
+	arena->stats.spans_dirty ++;
+	if(arena->stats.spans_dirty > HM_DIRTY_MAX+arena->reserve)
+		hm_mgr_purge_locked(arena, HM_DIRTY_MAX/2+arena->reserve);
+	hm_lock_release(&arena->lock);
+}
+
+/* keep is per arena */
+void hm_mgr_purge(hm_mgr* mgr, size_t keep)
+{
+	hm_arena* arena;
+	u32 node;
+
+	for(node = 0; node < mgr->nodes; node ++) {
+		arena = &mgr->arenas[node];
+		hm_lock_acquire(&arena->lock);
+		hm_mgr_purge_locked(arena, keep);
+		hm_lock_release(&arena->lock);
+	}
+}
+
+/* four buckets per power of two of the mapped length */
+static __inline u32 hm_large_bucket(size_t length)
+{
+	u32 shift = 63-(u32)__builtin_clzll(length-1);
+
+	return (shift-HM_LARGE_SHIFT)*4+(u32)(((length-1)>>(shift-2))&3);
+}
+
+/* the length a bucket maps, so any of its mappings serves any of its blocks */
+static __inline size_t hm_large_length(size_t length)
+{
+	u32 shift = 63-(u32)__builtin_clzll(length-1);
+
+	return ((length-1)|(((size_t)1<<(shift-2))-1))+1;
+}
+
+/* called with arena->lock held, the mappings to unmap go to victims */
+static void hm_large_evict_locked(hm_arena* arena, size_t keep, list_t* victims)
+{
+	hm_chunk* chunk;
+	u32 bucket = HM_LARGE_BUCKETS;
+
+	/* the biggest first, they free the most for one munmap */
+	while(arena->stats.large_cached_bytes > keep && bucket) {
+		if(list_empty(&arena->large[bucket-1])) {
+			bucket --;
+			continue;
+		}
+		chunk = list_last_entry(&arena->large[bucket-1], hm_chunk, list);
+		list_move(&chunk->list, victims);
+		arena->stats.large_cached --;
+		arena->stats.large_cached_bytes -= chunk->size;
+		arena->stats.mapped -= chunk->size;
+	}
+}
+
+static size_t hm_large_unmap(list_t* victims)
+{
+	hm_chunk *chunk, *next;
+	size_t bytes = 0;
+
+	list_for_each_entry_safe(chunk, next, victims, list) {
+		bytes += chunk->size;
+		hm_os_unmap(chunk, chunk->size);
+	}
+	return bytes;
+}
+
+/*
+ * a cached mapping of the bucket or of the next one, which maps at most a
+ * quarter more. the pages the block does not reach are released.
+ */
+static hm_chunk* hm_large_reuse(hm_arena* arena, u32 bucket, size_t length)
+{
+	hm_chunk* chunk;
+
+	hm_lock_acquire(&arena->lock);
+	if(list_empty(&arena->large[bucket]) &&
+		(++ bucket == HM_LARGE_BUCKETS || list_empty(&arena->large[bucket]))) {
+		hm_lock_release(&arena->lock);
+		return NULL;
+	}
+	chunk = list_first_entry(&arena->large[bucket], hm_chunk, list);
+	list_del(&chunk->list);
+	arena->stats.large_cached --;
+	arena->stats.large_cached_bytes -= chunk->size;
+	hm_lock_release(&arena->lock);
+
+	if(chunk->length > length)
+		hm_os_purge((char* )chunk+length, chunk->length-length);
+	return chunk;
+}
+
+/*
+ * chunks with every span on the clean list go back to the os, called with
+ * arena->lock held. a span taken off a free list but not set up yet is not
+ * on it, so its chunk stays.
+ */
+static size_t hm_mgr_unmap_locked(hm_arena* arena)
+{
+	hm_chunk *chunk, *next;
+	size_t bytes = 0;
+	u32 index;
+
+	list_for_each_entry_safe(chunk, next, &arena->chunks, list) {
+		if(chunk->clean != HM_CHUNK_SPANS-1)
+			continue;
+
+		for(index = 1; index < HM_CHUNK_SPANS; index ++)
+			list_del(&chunk->pools[index].list);
+		list_del(&chunk->list);
+		arena->stats.spans_clean -= HM_CHUNK_SPANS-1;
+		arena->stats.mapped -= HM_CHUNK_SIZE;
+		bytes += HM_CHUNK_SIZE;
+
+		chunk->magic = 0;
+		hm_os_unmap(chunk, HM_CHUNK_SIZE);
+	}
+	return bytes;
+}
+
+/*
+ * hand every free span back to the os and unmap the chunks left empty.
+ * returns the bytes that were resident or mapped before. empty spans still
+ * sit in task caches until those are drained, see hm_mem_trim().
+ */
+size_t hm_mgr_trim(hm_mgr* mgr)
+{
+	hm_arena* arena;
+	size_t bytes = 0;
+	list_t victims;
+	u32 node;
+
+	for(node = 0; node < mgr->nodes; node ++) {
+		arena = &mgr->arenas[node];
+		list_init(&victims);
+		hm_lock_acquire(&arena->lock);
+		hm_large_evict_locked(arena, 0, &victims);
+		bytes += arena->stats.spans_dirty*HM_SPAN_SIZE;
+		hm_mgr_purge_locked(arena, 0);
+		/* chunks of a range stay where they are */
+		if(!mgr->base)
+			bytes += hm_mgr_unmap_locked(arena);
+		hm_lock_release(&arena->lock);
+		bytes += hm_large_unmap(&victims);
+	}
+	return bytes;
+}
+
+/*
+ * make sure bytes worth of free spans are resident on node. pinned spans
+ * stay off the dirty list, so the purger never hands them back to the os.
+ * unpinned ones are kept from it by the arena reserve until they are used
+ * or purged explicitly.
+ */
+int hm_mgr_prefault(hm_mgr* mgr, u32 node, size_t bytes, u32 flags)
+{
+	hm_arena* arena = &mgr->arenas[node];
+	size_t count, ready, keep;
+	hm_pool *pool, *next;
+	list_t spans, fault;
+
+	count = hm_align_up(bytes, HM_SPAN_SIZE)>>HM_SPAN_SHIFT;
+	list_init(&spans);
+	list_init(&fault);
+
+	hm_lock_acquire(&arena->lock);
+	ready = arena->stats.spans_pinned;
+	if(!(flags&HM_PREFAULT_PIN))
+		ready += arena->stats.spans_dirty;
+
+	/* dirty spans only need the pin */
+	while(ready < count && (flags&HM_PREFAULT_PIN) && !list_empty(&arena->dirty)) {
+		list_move(arena->dirty.next, &spans);
+		arena->stats.spans_dirty --;
+		ready ++;
+	}
+	while(ready < count) {
+		if(list_empty(&arena->clean) && hm_mgr_chunk_map(mgr, arena))
+			break;
+		hm_chunk_of(arena->clean.next)->clean --;
+		list_move(arena->clean.next, &fault);
+		arena->stats.spans_clean --;
+		ready ++;
+	}
+	hm_lock_release(&arena->lock);
+
+	list_for_each_entry(pool, &fault, list) {
+		hm_os_populate(pool->base, HM_SPAN_SIZE);
+		flag_unset(pool, HM_POOL_PURGED);
+	}
+	list_splice_tail_init(&fault, &spans);
+
+	hm_lock_acquire(&arena->lock);
+	list_for_each_entry_safe(pool, next, &spans, list) {
+		if(flags&HM_PREFAULT_PIN) {
+			flag_set(pool, HM_POOL_PINNED);
+			list_move(&pool->list, &arena->pinned);
+			arena->stats.spans_pinned ++;
+		}
+		else {
+			list_move(&pool->list, &arena->dirty);
+			arena->stats.spans_dirty ++;
+		}
+	}
+	if(!(flags&HM_PREFAULT_PIN)) {
+		/* pinned spans counted as ready need no reserve */
+		keep = ready < count ? ready : count;
+		keep = keep > arena->stats.spans_pinned ? keep-arena->stats.spans_pinned : 0;
+		if(keep > arena->stats.spans_dirty)
+			keep = arena->stats.spans_dirty;
+		if(arena->reserve < keep)
+			arena->reserve = keep;
+	}
+	hm_lock_release(&arena->lock);
+
+	return ready < count ? -1 : 0;
+}
+
+static __inline u32 hm_class_bin(hm_pool* pool)
+{
+	u32 bin = (u32)((u64)pool->used*HM_CLASS_BINS/pool->total);
+
+	return bin < HM_CLASS_BINS ? bin : HM_CLASS_BINS-1;
+}
+
+/*
+ * the fullest partial pool, so sparse ones get no new blocks and can
+ * empty out. called with cls->lock held.
+ */
+static hm_pool* hm_class_pool(hm_class* cls)
+{
+	u32 bin = HM_CLASS_BINS;
+
+	while(bin --) {
+		if(!list_empty(&cls->pools[bin]))
+			return list_first_entry(&cls->pools[bin], hm_pool, list);
+	}
+	return NULL;
+}
+
+u32 hm_mgr_refill(hm_mgr* mgr, u32 node, u32 klass, void** head, u32 count)
+{
+	hm_arena* arena = &mgr->arenas[node];
+	hm_class* cls = &arena->classes[klass];
+	hm_pool* pool;
+	u32 n = 0;
+
+	hm_lock_acquire(&cls->lock);
+	while(n < count) {
+		pool = hm_class_pool(cls);
+		if(!pool) {
+			pool = hm_mgr_span_alloc(mgr, arena);
+			if(!pool)
+				break;
+			hm_pool_init(pool, klass);
+		}
+		else
+			list_del_init(&pool->list);
+
+		n += hm_pool_pop(pool, head, count-n);
+		if(hm_pool_full(pool))
+			flag_set(pool, HM_POOL_FULL);
+		else
+			list_add(&pool->list, &cls->pools[hm_class_bin(pool)]);
+	}
+	hm_lock_release(&cls->lock);
+
+	return n;
+}
+
+static void hm_arena_flush(hm_arena* arena, u32 klass, void* head)
+{
+	hm_class* cls = &arena->classes[klass];
+	hm_pool* pool;
+	void* block;
+	u32 bin;
+
+	hm_lock_acquire(&cls->lock);
+	while((block = head)) {
+		head = *(void** )block;
+		pool = hm_chunk_pool(hm_chunk_of(block), block);
+		assert(pool->klass == klass);
+
+		bin = hm_class_bin(pool);
+		hm_pool_push(pool, block);
+		if(!pool->used) {
+			if(flag_test(pool, HM_POOL_FULL))
+				flag_unset(pool, HM_POOL_FULL);
+			else
+				list_del_init(&pool->list);
+			hm_mgr_span_release(arena, pool);
+		}
+		else if(flag_test(pool, HM_POOL_FULL)) {
+			flag_unset(pool, HM_POOL_FULL);
+			list_add_tail(&pool->list, &cls->pools[hm_class_bin(pool)]);
+		}
+		else if(bin != hm_class_bin(pool))
+			list_move(&pool->list, &cls->pools[hm_class_bin(pool)]);
+	}
+	hm_lock_release(&cls->lock);
+}
+
+/*
+ * return a NULL terminated chain of blocks of one class to their pools,
+ * each block goes back to the arena of its home node.
+ */
+void hm_mgr_flush(hm_mgr* mgr, u32 klass, void* head)
+{
+	void* heads[HM_NODE_MAX];
+	void* block;
+	u32 node;
+
+	if(mgr->nodes == 1) {
+		hm_arena_flush(&mgr->arenas[0], klass, head);
+		return;
+	}
+
+	memset(heads, 0, sizeof(heads));
+	while((block = head)) {
+		head = *(void** )block;
+		node = hm_chunk_of(block)->node;
+		*(void** )block = heads[node];
+		heads[node] = block;
+	}
+
+	for(node = 0; node < mgr->nodes; node ++) {
+		if(heads[node])
+			hm_arena_flush(&mgr->arenas[node], klass, heads[node]);
+	}
+}
+
+/*
+ * every large block has a mapping of its own, its header is in the first
+ * pages. mappings up to HM_LARGE_CACHE are mapped to the end of their
+ * bucket and cached when freed.
+ */
+void* hm_mgr_alloc_large(hm_mgr* mgr, u32 node, size_t size)
+{
+	hm_arena* arena = &mgr->arenas[node];
+	hm_chunk* chunk = NULL;
+	size_t length, mapped;
+	u32 bucket = HM_LARGE_BUCKETS;
+
+	length = HM_CHUNK_HEADER+hm_align_up(size, HM_PAGE_SIZE);
+	if(length < size)
+		return NULL;
+
+	mapped = length;
+	/* the next chunk of a range starts right after it */
+	if(mgr->base)
+		mapped = hm_align_up(length, HM_CHUNK_SIZE);
+	else if((bucket = hm_large_bucket(length)) < HM_LARGE_BUCKETS) {
+		mapped = hm_large_length(length);
+		chunk = hm_large_reuse(arena, bucket, length);
+	}
+
+	if(!chunk) {
+		chunk = hm_mgr_map(mgr, mapped);
+		if(!chunk)
+			return NULL;
+		if(mgr->nodes > 1)
+			hm_os_bind(chunk, mapped, arena->node);
+		chunk->size = mapped;
+
+		hm_lock_acquire(&arena->lock);
+		arena->stats.mapped += mapped;
+		hm_lock_release(&arena->lock);
+	}
+
+	chunk->magic = HM_CHUNK_MAGIC;
+	chunk->kind = HM_CHUNK_LARGE;
+	chunk->node = node;
+	chunk->mgr = mgr;
+	chunk->length = length;
+
+	hm_lock_acquire(&arena->lock);
+	arena->stats.large ++;
+	arena->stats.large_bytes += length-HM_CHUNK_HEADER;
+	hm_lock_release(&arena->lock);
+
+	return (char* )chunk+HM_CHUNK_HEADER;
+}
+
+void hm_mgr_free_large(hm_mgr* mgr, hm_chunk* chunk)
+{
+	hm_arena* arena = &mgr->arenas[chunk->node];
+	size_t size = chunk->size;
+	list_t victims;
+
+	list_init(&victims);
+	chunk->magic = 0;
+
+	hm_lock_acquire(&arena->lock);
+	arena->stats.large --;
+	arena->stats.large_bytes -= chunk->length-HM_CHUNK_HEADER;
+	/* by what it maps, it may have served a block of the bucket below */
+	if(!mgr->base && hm_large_bucket(size) < HM_LARGE_BUCKETS && size <= HM_LARGE_CACHE) {
+		hm_large_evict_locked(arena, HM_LARGE_CACHE-size, &victims);
+		list_add(&chunk->list, &arena->large[hm_large_bucket(size)]);
+		arena->stats.large_cached ++;
+		arena->stats.large_cached_bytes += size;
+		hm_lock_release(&arena->lock);
+
+		hm_large_unmap(&victims);
+		return;
+	}
+	if(!mgr->base)
+		arena->stats.mapped -= size;
+	hm_lock_release(&arena->lock);
+
+	/* a range keeps the hole, size still leads past it */
+	if(mgr->base)
+		hm_os_purge((char* )chunk+HM_CHUNK_HEADER, size-HM_CHUNK_HEADER);
+	else
+		hm_os_unmap(chunk, size);
+}
+
+/* uncached paths, used when there is no task cache for the pointer */
+void* hm_mgr_alloc(hm_mgr* mgr, size_t size)
+{
+	void* block = NULL;
+	u32 node;
+
+	/* hm_mgr_main before hm_initialize() got through */
+	if(hm_unlikely(!mgr->nodes))
+		return NULL;
+
+	node = hm_mgr_node(mgr);
+	if(size > HM_SMALL_MAX)
+		return hm_mgr_alloc_large(mgr, node, size);
+
+	hm_mgr_refill(mgr, node, hm_pool_class(size), &block, 1);
+	return block;
+}
+
+void hm_mgr_free(hm_mgr* mgr, void* ptr)
+{
+	hm_chunk* chunk = hm_chunk_of(ptr);
+
+	assert(chunk->magic == HM_CHUNK_MAGIC);
+	if(flag_test(chunk, HM_CHUNK_FROZEN))
+		return;
+	if(chunk->kind == HM_CHUNK_LARGE) {
+		hm_mgr_free_large(mgr, chunk);
+		return;
+	}
+	if(chunk->kind == HM_CHUNK_GUARD) {
+		hm_guard_free(ptr);
+		return;
+	}
+
+	*(void** )ptr = NULL;
+	hm_arena_flush(hm_chunk_arena(chunk), hm_chunk_pool(chunk, ptr)->klass, ptr);
+}
+
+size_t hm_mgr_usable_size(const void* ptr)
+{
+	hm_chunk* chunk = hm_chunk_of(ptr);
+
+	assert(chunk->magic == HM_CHUNK_MAGIC);
+	if(chunk->kind == HM_CHUNK_LARGE)
+		return chunk->length-HM_CHUNK_HEADER;
+	if(chunk->kind == HM_CHUNK_GUARD)
+		return hm_guard_usable_size(ptr);
+
+	return hm_chunk_pool(chunk, ptr)->size;
+}
+
+void hm_mgr_node_stats(hm_mgr* mgr, u32 node, hm_stats* stats)
+{
+	hm_arena* arena = &mgr->arenas[node];
+
+	hm_lock_acquire(&arena->lock);
+	*stats = arena->stats;
+	hm_lock_release(&arena->lock);
+}
+
+/*
+ * frag is indexed by size class, see hm_pool_class(). a snapshot taken
+ * while allocations go on, pools are read without their class locks.
+ */
+void hm_mgr_frag(hm_mgr* mgr, hm_frag* frag)
+{
+	hm_arena* arena;
+	hm_chunk* chunk;
+	hm_pool* pool;
+	u32 node, index, klass, used, total;
+
+	memset(frag, 0, sizeof(hm_frag)*HM_CLASS_MAX);
+	for(klass = 1; klass < hm_pool_classes; klass ++)
+		frag[klass].size = hm_pool_sizes[klass];
+
+	for(node = 0; node < mgr->nodes; node ++) {
+		arena = &mgr->arenas[node];
+		hm_lock_acquire(&arena->lock);
+		list_for_each_entry(chunk, &arena->chunks, list) {
+			for(index = 1; index < HM_CHUNK_SPANS; index ++) {
+				pool = &chunk->pools[index];
+				klass = __atomic_load_n(&pool->klass, __ATOMIC_RELAXED);
+				used = __atomic_load_n(&pool->used, __ATOMIC_RELAXED);
+				total = pool->total;
+				/* a pool being set up may pair the fields of two classes */
+				if(!klass || klass >= hm_pool_classes || !total || used > total ||
+					(size_t)used*frag[klass].size > HM_SPAN_SIZE)
+					continue;
+
+				frag[klass].spans ++;
+				frag[klass].used += used;
+				frag[klass].wasted += HM_SPAN_SIZE-(size_t)used*frag[klass].size;
+				frag[klass].histogram[(u64)used*(HM_FRAG_BUCKETS-1)/total] ++;
+			}
+		}
+		hm_lock_release(&arena->lock);
+	}
+}
+
+/* summed over the arenas */
+void hm_mgr_stats(hm_mgr* mgr, hm_stats* stats)
+{
+	hm_stats node;
+	u32 index;
+
+	memset(stats, 0, sizeof(hm_stats));
+	for(index = 0; index < mgr->nodes; index ++) {
+		hm_mgr_node_stats(mgr, index, &node);
+		stats->mapped += node.mapped;
+		stats->spans += node.spans;
+		stats->spans_dirty += node.spans_dirty;
+		stats->spans_clean += node.spans_clean;
+		stats->spans_pinned += node.spans_pinned;
+		stats->large += node.large;
+		stats->large_bytes += node.large_bytes;
+		stats->large_cached += node.large_cached;
+		stats->large_cached_bytes += node.large_cached_bytes;
+	}
+
+	stats->mmaps = hm_atomic_load(&hm_os_calls[HM_OS_MMAP]);
+	stats->munmaps = hm_atomic_load(&hm_os_calls[HM_OS_MUNMAP]);
+	stats->madvises = hm_atomic_load(&hm_os_calls[HM_OS_MADVISE]);
+	stats->mprotects = hm_atomic_load(&hm_os_calls[HM_OS_MPROTECT]);
+}
@@ -0,0 +1,289 @@
+#define _GNU_SOURCE
+
+#include "hm_def.h"
+#include "hm_osi.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+u64 hm_os_calls[HM_OS_CALLS];
+
+#define hm_os_count(call) hm_atomic_add(&hm_os_calls[call], 1)
+
+void* hm_os_map(size_t size)
+{
+	void* addr;
+
+	hm_os_count(HM_OS_MMAP);
+	addr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(addr == MAP_FAILED)
+		return NULL;
+
+	return addr;
+}
+
+/* the last aligned mapping, the next one usually fits right below it */
+static char* hm_os_last;
+
+/*
+ * try the aligned address below the last aligned mapping, which top down
+ * placement usually leaves free. only then map align more and trim it.
+ */
+void* hm_os_map_aligned(size_t size, size_t align)
+{
+	char *addr, *hint, *last;
+	size_t head, tail;
+
+	last = __atomic_load_n(&hm_os_last, __ATOMIC_RELAXED);
+	hint = last && (uintptr_t)last > size ? (char* )hm_align_down((uintptr_t)last-size, align) : NULL;
+	hm_os_count(HM_OS_MMAP);
+	addr = mmap(hint, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(addr != MAP_FAILED) {
+		if(!((uintptr_t)addr&(align-1)))
+			goto out;
+		hm_os_unmap(addr, size);
+	}
+
+	addr = hm_os_map(size+align);
+	if(!addr)
+		return NULL;
+
+	head = hm_align_up((uintptr_t)addr, align)-(uintptr_t)addr;
+	tail = align-head;
+	if(head)
+		hm_os_unmap(addr, head);
+	if(tail)
+		hm_os_unmap(addr+head+size, tail);
+	addr += head;
+
+out:
+	__atomic_store_n(&hm_os_last, addr, __ATOMIC_RELAXED);
+	return addr;
+}
+
+void hm_os_unmap(void* addr, size_t size)
+{
+	hm_os_count(HM_OS_MUNMAP);
+	munmap(addr, size);
+}
+
+void hm_os_purge(void* addr, size_t size)
+{
+	hm_os_count(HM_OS_MADVISE);
+	madvise(addr, size, MADV_DONTNEED);
+}
+
+/* rw 0 makes the range inaccessible */
+int hm_os_protect(void* addr, size_t size, int rw)
+{
+	hm_os_count(HM_OS_MPROTECT);
+	return mprotect(addr, size, rw ? PROT_READ|PROT_WRITE : PROT_NONE) ? -1 : 0;
+}
+
+int hm_os_readonly(void* addr, size_t size)
+{
+	hm_os_count(HM_OS_MPROTECT);
+	return mprotect(addr, size, PROT_READ) ? -1 : 0;
+}
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+/* NULL when something already sits in the range */
+void* hm_os_map_at(void* addr, size_t size)
+{
+	void* map;
+
+	hm_os_count(HM_OS_MMAP);
+	map = mmap(addr, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED_NOREPLACE, -1, 0);
+	if(map == MAP_FAILED)
+		return NULL;
+	/* kernels before 4.17 take the flag as a hint */
+	if(map != addr) {
+		hm_os_unmap(map, size);
+		return NULL;
+	}
+
+	return map;
+}
+
+/* private file pages over a range reserved by the caller */
+void* hm_os_map_file(int fd, void* addr, size_t size, size_t offset, int writable)
+{
+	void* map;
+
+	hm_os_count(HM_OS_MMAP);
+	map = mmap(addr, size, writable ? PROT_READ|PROT_WRITE : PROT_READ, MAP_PRIVATE|MAP_FIXED, fd, (off_t)offset);
+	if(map == MAP_FAILED)
+		return NULL;
+
+	return map;
+}
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+/* fault pages in ahead of use, touching them on kernels before 5.14 */
+void hm_os_populate(void* addr, size_t size)
+{
+	char* pos;
+
+	hm_os_count(HM_OS_MADVISE);
+	if(!madvise(addr, size, MADV_POPULATE_WRITE))
+		return;
+
+	for(pos = addr; pos < (char* )addr+size; pos += HM_PAGE_SIZE)
+		__atomic_fetch_add(pos, 0, __ATOMIC_RELAXED);
+}
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+/* numa nodes the system can have online, from the highest node id */
+u32 hm_os_nodes()
+{
+	char line[256], *pos;
+	long node, nodes;
+	FILE* fp;
+
+	fp = fopen("/sys/devices/system/node/possible", "r");
+	if(!fp)
+		return 1;
+
+	nodes = 1;
+	if(fgets(line, sizeof(line), fp)) {
+		for(pos = line; *pos; pos ++) {
+			if(*pos < '0' || *pos > '9')
+				continue;
+			node = strtol(pos, &pos, 10);
+			if(node+1 > nodes)
+				nodes = node+1;
+			if(!*pos)
+				break;
+		}
+	}
+	fclose(fp);
+
+	return (u32)nodes;
+}
+
+/* node of the cpu the caller runs on, read through the vdso */
+u32 hm_os_node()
+{
+	unsigned int cpu, node;
+
+	if(getcpu(&cpu, &node))
+		return 0;
+	return node;
+}
+
+/*
+ * prefer node for pages faulted in later. a full node falls back to the
+ * others instead of failing the fault.
+ */
+int hm_os_bind(void* addr, size_t size, u32 node)
+{
+	unsigned long mask[HM_NODE_MAX/(8*sizeof(unsigned long))+1];
+
+	memset(mask, 0, sizeof(mask));
+	mask[node/(8*sizeof(unsigned long))] = 1ul<<(node%(8*sizeof(unsigned long)));
+	return syscall(SYS_mbind, addr, size, MPOL_PREFERRED, mask, sizeof(mask)*8, 0) ? -1 : 0;
+}
+
+/* a NULL name gives an anonymous memfd that is shared by passing the fd */
+int hm_os_shm_create(const char* name, size_t size)
+{
+	int fd;
+
+	if(name)
+		fd = shm_open(name, O_CREAT|O_EXCL|O_RDWR|O_CLOEXEC, 0600);
+	else
+		fd = memfd_create("hotmem", MFD_CLOEXEC);
+	if(fd < 0)
+		return -1;
+
+	if(ftruncate(fd, (off_t)size)) {
+		close(fd);
+		if(name)
+			shm_unlink(name);
+		return -1;
+	}
+
+	return fd;
+}
+
+int hm_os_shm_open(const char* name, size_t* size)
+{
+	struct stat st;
+	int fd;
+
+	fd = shm_open(name, O_RDWR|O_CLOEXEC, 0);
+	if(fd < 0)
+		return -1;
+
+	if(fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+
+	*size = (size_t)st.st_size;
+	return fd;
+}
+
+void* hm_os_map_shared(int fd, size_t size)
+{
+	void* addr;
+
+	hm_os_count(HM_OS_MMAP);
+	addr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if(addr == MAP_FAILED)
+		return NULL;
+
+	return addr;
+}
+
+/* process start time in clock ticks since boot, tells a reused pid apart */
+u64 hm_os_start(int pid)
+{
+	char path[64], buf[512], *pos;
+	unsigned long long start;
+	int field;
+	FILE* fp;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	fp = fopen(path, "r");
+	if(!fp)
+		return 0;
+	pos = fgets(buf, sizeof(buf), fp);
+	fclose(fp);
+	if(!pos)
+		return 0;
+
+	/* the command name may contain spaces, count fields after its ')' */
+	pos = strrchr(buf, ')');
+	if(!pos)
+		return 0;
+	for(field = 2; field < 22 && pos; field ++)
+		pos = strchr(pos+1, ' ');
+	if(!pos || sscanf(pos, "%llu", &start) != 1)
+		return 0;
+
+	return start;
+}
+
+int hm_os_alive(int pid, u64 start)
+{
+	if(kill(pid, 0) && errno == ESRCH)
+		return 0;
+
+	return !start || hm_os_start(pid) == start;
+}
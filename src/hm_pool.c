@@ -1 +1,239 @@
+#include "hm_def.h"
+#include "hm_osi.h"
 
+#include "hm_pool.h"
+
+#include <stdio.h>
+
+#ifdef HM_CLASS_TABLE
+/* generated by tools/hm_classgen, defines hm_pool_table[] */
+#include HM_CLASS_TABLE
+#endif
+
+/*
+ * the built in table is there at compile time, 16 byte steps up to 128,
+ * then four classes per power of two. hm_pool_initialize() only replaces
+ * it with another one.
+ */
+#define HM_POOL_QUARTERS(base) \
+	(base)+((base)>>2), (base)+((base)>>1), (base)+3*((base)>>2), (base)<<1
+
+/* the class of a lookup index in the built in table, see hm_pool_index() */
+#define HM_POOL_AT(i) ((i) <= 64 ? (u32)(i)<<4 : (u32)((i)-56)<<7)
+#define HM_POOL_LOG(size) (31-__builtin_clz((size)-1))
+#define HM_POOL_UPPER(size) \
+	(9+4*(HM_POOL_LOG(size)-7)+((((size)-1)>>(HM_POOL_LOG(size)-2))&3))
+#define HM_POOL_CLASS(size) \
+	((size) <= 128 ? ((size) ? (size)>>4 : 1) : HM_POOL_UPPER((size) > 128 ? (size) : 129))
+
+#define HM_POOL_L1(i) HM_POOL_CLASS(HM_POOL_AT(i)),
+#define HM_POOL_L2(i) HM_POOL_L1(i) HM_POOL_L1((i)+1)
+#define HM_POOL_L4(i) HM_POOL_L2(i) HM_POOL_L2((i)+2)
+#define HM_POOL_L8(i) HM_POOL_L4(i) HM_POOL_L4((i)+4)
+#define HM_POOL_L16(i) HM_POOL_L8(i) HM_POOL_L8((i)+8)
+#define HM_POOL_L32(i) HM_POOL_L16(i) HM_POOL_L16((i)+16)
+#define HM_POOL_L64(i) HM_POOL_L32(i) HM_POOL_L32((i)+32)
+#define HM_POOL_L128(i) HM_POOL_L64(i) HM_POOL_L64((i)+64)
+#define HM_POOL_L256(i) HM_POOL_L128(i) HM_POOL_L128((i)+128)
+
+_Static_assert(HM_SMALL_MAX == (32u<<10) && HM_CLASS_LOOKUP == 313,
+	"the built in size class table is written for HM_SMALL_MAX 32 KiB");
+
+u32 hm_pool_classes = 41;
+u32 hm_pool_sizes[HM_CLASS_MAX] = {
+	0, 16, 32, 48, 64, 80, 96, 112, 128,
+	HM_POOL_QUARTERS(128), HM_POOL_QUARTERS(256), HM_POOL_QUARTERS(512),
+	HM_POOL_QUARTERS(1024), HM_POOL_QUARTERS(2048), HM_POOL_QUARTERS(4096),
+	HM_POOL_QUARTERS(8192), HM_POOL_QUARTERS(16384)
+};
+u8 hm_pool_lookup[HM_CLASS_LOOKUP] = {
+	HM_POOL_L256(0) HM_POOL_L32(256) HM_POOL_L16(288) HM_POOL_L8(304) HM_POOL_L1(312)
+};
+
+int hm_pool_profiling;
+u64 hm_pool_profile[HM_PROFILE_BUCKETS];
+
+HM_TLS u32 hm_pool_countdown = 1;
+
+/*
+ * sizes ascending and HM_ALIGN aligned, HM_SMALL_MAX is added when the
+ * table stops short of it
+ */
+int hm_pool_setup(const u32* sizes, u32 count)
+{
+	u32 klass, size, index;
+
+	if(!count || count >= HM_CLASS_MAX)
+		return -1;
+	for(index = 0; index < count; index ++) {
+		if(!sizes[index] || sizes[index]%HM_ALIGN || sizes[index] > HM_SMALL_MAX)
+			return -1;
+		if(index && sizes[index] <= sizes[index-1])
+			return -1;
+	}
+	if(sizes[count-1] != HM_SMALL_MAX && count+1 >= HM_CLASS_MAX)
+		return -1;
+
+	memset(hm_pool_sizes, 0, sizeof(hm_pool_sizes));
+	memcpy(hm_pool_sizes+1, sizes, count*sizeof(u32));
+	klass = count+1;
+	if(sizes[count-1] != HM_SMALL_MAX)
+		hm_pool_sizes[klass ++] = HM_SMALL_MAX;
+	hm_pool_classes = klass;
+
+	klass = 1;
+	for(index = 0; index < HM_CLASS_LOOKUP; index ++) {
+		size = index <= 64 ? index<<4 : (index-56)<<7;
+		while(hm_pool_sizes[klass] < size)
+			klass ++;
+		hm_pool_lookup[index] = (u8)klass;
+	}
+
+	return 0;
+}
+
+/* a header written by hm_classgen, or a plain list of sizes */
+int hm_pool_load(const char* path)
+{
+	u32 sizes[HM_CLASS_MAX];
+	char buf[8192], *pos, *end;
+	unsigned long size;
+	u32 count;
+	size_t n;
+	FILE* fp;
+
+	fp = fopen(path, "r");
+	if(!fp)
+		return -1;
+	n = fread(buf, 1, sizeof(buf)-1, fp);
+	fclose(fp);
+	buf[n] = 0;
+
+	pos = strchr(buf, '{');
+	pos = pos ? pos+1 : buf;
+	count = 0;
+	while(*pos && *pos != '}') {
+		if(*pos < '0' || *pos > '9') {
+			pos ++;
+			continue;
+		}
+		size = strtoul(pos, &end, 10);
+		if(count == HM_CLASS_MAX)
+			return -1;
+		sizes[count ++] = (u32)size;
+		pos = end;
+	}
+
+	return hm_pool_setup(sizes, count);
+}
+
+/*
+ * HOTMEM_CLASSES names a table to use instead of the built in one, so does
+ * a table compiled in. one that does not load leaves the built in table.
+ */
+int hm_pool_initialize()
+{
+	const char* path;
+
+	path = getenv("HOTMEM_CLASSES");
+	if(path && *path && !hm_pool_load(path))
+		return 0;
+
+#ifdef HM_CLASS_TABLE
+	hm_pool_setup(hm_pool_table, array_size(hm_pool_table));
+#endif
+
+	return 0;
+}
+
+void hm_pool_init(hm_pool* pool, u32 klass)
+{
+	pool->free = NULL;
+	pool->bump = pool->base;
+	pool->size = hm_pool_sizes[klass];
+	pool->total = (u32)(HM_SPAN_SIZE/pool->size);
+	pool->end = pool->base+pool->total*pool->size;
+	pool->used = 0;
+	pool->klass = (u16)klass;
+	flag_unset(pool, HM_POOL_FULL);
+}
+
+/* chain up to count blocks onto head, reusing freed blocks before fresh ones */
+u32 hm_pool_pop(hm_pool* pool, void** head, u32 count)
+{
+	void* block;
+	u32 n = 0;
+
+	while(n < count && (block = pool->free)) {
+		pool->free = *(void** )block;
+		*(void** )block = *head;
+		*head = block;
+		n ++;
+	}
+
+	while(n < count && pool->bump < pool->end) {
+		block = pool->bump;
+		pool->bump += pool->size;
+		*(void** )block = *head;
+		*head = block;
+		n ++;
+	}
+
+	pool->used += n;
+	return n;
+}
+
+/* a cheap fingerprint of the table, processes sharing memory must agree on it */
+u32 hm_pool_signature()
+{
+	u32 hash, klass;
+
+	hash = 2166136261u;
+	for(klass = 1; klass < hm_pool_classes; klass ++)
+		hash = (hash^hm_pool_sizes[klass])*16777619u;
+
+	return hash;
+}
+
+void hm_pool_profile_start()
+{
+	memset(hm_pool_profile, 0, sizeof(hm_pool_profile));
+	hm_atomic_store(&hm_pool_profiling, 1);
+	/* other threads start recording when their countdown runs out */
+	hm_pool_countdown = 1;
+}
+
+void hm_pool_profile_stop()
+{
+	hm_atomic_store(&hm_pool_profiling, 0);
+}
+
+void hm_pool_record(size_t size)
+{
+	size_t bucket = (size+HM_ALIGN-1)/HM_ALIGN;
+
+	if(bucket >= HM_PROFILE_BUCKETS)
+		bucket = HM_PROFILE_BUCKETS-1;
+	hm_atomic_add(&hm_pool_profile[bucket], 1);
+}
+
+/* "size count" lines for hm_classgen, sizes past HM_SMALL_MAX are folded into one */
+int hm_pool_profile_dump(const char* path)
+{
+	size_t bucket;
+	u64 count;
+	FILE* fp;
+
+	fp = fopen(path, "w");
+	if(!fp)
+		return -1;
+
+	fprintf(fp, "# hotmem size histogram, size count\n");
+	for(bucket = 0; bucket < HM_PROFILE_BUCKETS; bucket ++) {
+		count = hm_atomic_load(&hm_pool_profile[bucket]);
+		if(count)
+			fprintf(fp, "%zu %llu\n", bucket*HM_ALIGN, (unsigned long long)count);
+	}
+
+	return fclose(fp) ? -1 : 0;
+}
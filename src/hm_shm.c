@@ -0,0 +1,511 @@
+#include "hm_def.h"
+#include "hm_osi.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hm_mem.h"
+#include "hm_shm.h"
+
+#define HM_SHM_BLOCK	sizeof(hm_shm_block)
+
+static __inline hm_shm_block* hm_shm_block_of(hm_shm* shm, hm_shm_ptr ptr)
+{
+	return (hm_shm_block* )((char* )shm->seg+ptr-HM_SHM_BLOCK);
+}
+
+static __inline u32 hm_shm_index(hm_shm_ptr ptr)
+{
+	return (u32)((ptr-HM_SHM_BLOCK)>>HM_SPAN_SHIFT);
+}
+
+/* the robust mutex only guards span assignment, a holder that died left it consistent enough */
+static void hm_shm_lock(hm_shm_seg* seg)
+{
+	if(pthread_mutex_lock(&seg->lock) == EOWNERDEAD)
+		pthread_mutex_consistent(&seg->lock);
+}
+
+static void hm_shm_unlock(hm_shm_seg* seg)
+{
+	pthread_mutex_unlock(&seg->lock);
+}
+
+static int hm_shm_format(hm_shm_seg* seg, size_t size)
+{
+	pthread_mutexattr_t attr;
+	size_t header;
+
+	seg->size = size;
+	seg->nspans = (u32)(size>>HM_SPAN_SHIFT);
+	header = sizeof(hm_shm_seg)+seg->nspans*sizeof(hm_shm_span);
+	seg->first = (u32)(hm_align_up(header, HM_SPAN_SIZE)>>HM_SPAN_SHIFT);
+	if(seg->first >= seg->nspans)
+		return -1;
+
+	if(pthread_mutexattr_init(&attr))
+		return -1;
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	if(pthread_mutex_init(&seg->lock, &attr)) {
+		pthread_mutexattr_destroy(&attr);
+		return -1;
+	}
+	pthread_mutexattr_destroy(&attr);
+
+	seg->version = HM_SHM_VERSION;
+	seg->table = hm_pool_signature();
+	hm_atomic_store(&seg->magic, HM_SHM_MAGIC);
+	return 0;
+}
+
+static int hm_shm_join(hm_shm* shm)
+{
+	hm_shm_slot* slot;
+	int pid, none;
+	u32 index;
+
+	pid = getpid();
+	for(index = 0; index < HM_SHM_SLOTS; index ++) {
+		slot = &shm->seg->slots[index];
+		none = 0;
+		if(hm_atomic_cas(&slot->pid, &none, pid)) {
+			slot->start = hm_os_start(pid);
+			shm->slot = index;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static hm_shm* hm_shm_map(int fd, size_t size, int format)
+{
+	hm_shm* shm;
+
+	/* the segment records the size class table, it has to be settled first */
+	if(hm_initialize())
+		return NULL;
+
+	shm = k_malloc(sizeof(hm_shm));
+	if(!shm)
+		return NULL;
+	memset(shm, 0, sizeof(hm_shm));
+	hm_lock_init(&shm->lock);
+	shm->fd = fd;
+	shm->size = size;
+
+	shm->seg = hm_os_map_shared(fd, size);
+	if(!shm->seg) {
+		k_free(shm);
+		return NULL;
+	}
+
+	if(format ? hm_shm_format(shm->seg, size) :
+		hm_atomic_load(&shm->seg->magic) != HM_SHM_MAGIC || shm->seg->version != HM_SHM_VERSION ||
+		shm->seg->table != hm_pool_signature())
+		goto fail;
+
+	/* every slot taken, try to free the ones of dead processes */
+	if(hm_shm_join(shm)) {
+		hm_shm_recover(shm);
+		if(hm_shm_join(shm))
+			goto fail;
+	}
+
+	return shm;
+
+fail:
+	hm_os_unmap(shm->seg, size);
+	k_free(shm);
+	return NULL;
+}
+
+hm_shm* hm_shm_create(const char* name, size_t size)
+{
+	hm_shm* shm;
+	int fd;
+
+	size = hm_align_up(size, HM_SPAN_SIZE);
+	fd = hm_os_shm_create(name, size);
+	if(fd < 0)
+		return NULL;
+
+	shm = hm_shm_map(fd, size, 1);
+	if(!shm) {
+		close(fd);
+		if(name)
+			shm_unlink(name);
+	}
+	return shm;
+}
+
+hm_shm* hm_shm_open(const char* name)
+{
+	hm_shm* shm;
+	size_t size;
+	int fd;
+
+	fd = hm_os_shm_open(name, &size);
+	if(fd < 0)
+		return NULL;
+
+	shm = hm_shm_map(fd, size, 0);
+	if(!shm)
+		close(fd);
+	return shm;
+}
+
+/* a memfd handed over by fork or SCM_RIGHTS, the caller keeps its descriptor */
+hm_shm* hm_shm_attach(int fd)
+{
+	struct stat st;
+	hm_shm* shm;
+
+	fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	if(fd < 0)
+		return NULL;
+	if(fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+
+	shm = hm_shm_map(fd, (size_t)st.st_size, 0);
+	if(!shm)
+		close(fd);
+	return shm;
+}
+
+int hm_shm_unlink(const char* name)
+{
+	return shm_unlink(name) ? -1 : 0;
+}
+
+/* called with seg->lock held */
+static u32 hm_shm_span_alloc(hm_shm_seg* seg, u32 count, u32 klass)
+{
+	u32 index, run, head;
+
+	for(index = seg->first, run = 0; index < seg->nspans; index ++) {
+		if(seg->spans[index].klass) {
+			run = 0;
+			continue;
+		}
+		if(++ run < count)
+			continue;
+
+		head = index+1-count;
+		for(index = head; index < head+count; index ++)
+			seg->spans[index].klass = (u16)klass;
+		seg->spans[head].run = count;
+		return head;
+	}
+
+	return 0;
+}
+
+/* called with seg->lock held */
+static void hm_shm_span_release(hm_shm_seg* seg, u32 head)
+{
+	hm_shm_span* span = &seg->spans[head];
+	u32 index, count;
+
+	count = span->run;
+	span->free = 0;
+	span->bump = 0;
+	span->owner = 0;
+	span->run = 0;
+	hm_atomic_store(&span->state, 0);
+	for(index = head; index < head+count; index ++)
+		seg->spans[index].klass = 0;
+}
+
+/* drop one live block, the last block of an orphaned span releases it */
+static void hm_shm_put(hm_shm* shm, u32 index, int locked)
+{
+	hm_shm_span* span = &shm->seg->spans[index];
+
+	if(__atomic_fetch_sub(&span->state, 1, __ATOMIC_ACQ_REL) != (HM_SHM_ORPHAN|1))
+		return;
+
+	if(!locked)
+		hm_shm_lock(shm->seg);
+	hm_shm_span_release(shm->seg, index);
+	if(!locked)
+		hm_shm_unlock(shm->seg);
+}
+
+/* give up allocating from a span, it goes back once its live blocks are freed */
+static void hm_shm_orphan(hm_shm* shm, u32 index, int locked)
+{
+	hm_shm_span* span = &shm->seg->spans[index];
+
+	span->owner = 0;
+	if(__atomic_fetch_or(&span->state, HM_SHM_ORPHAN, __ATOMIC_ACQ_REL))
+		return;
+
+	if(!locked)
+		hm_shm_lock(shm->seg);
+	hm_shm_span_release(shm->seg, index);
+	if(!locked)
+		hm_shm_unlock(shm->seg);
+}
+
+/* called with shm->lock held */
+static hm_shm_ptr hm_shm_pop(hm_shm* shm, u32 klass)
+{
+	hm_shm_seg* seg = shm->seg;
+	hm_shm_span* span;
+	hm_shm_ptr ptr;
+	u32 index, size;
+
+	size = hm_pool_sizes[klass];
+	for(;;) {
+		index = shm->current[klass];
+		if(index) {
+			span = &seg->spans[index];
+			ptr = shm->local[klass];
+			if(!ptr)
+				ptr = __atomic_exchange_n(&span->free, 0, __ATOMIC_ACQUIRE);
+			if(ptr) {
+				shm->local[klass] = hm_shm_block_of(shm, ptr)->next;
+				hm_atomic_store(&hm_shm_block_of(shm, ptr)->owner, shm->slot+1);
+				break;
+			}
+			if(span->bump+size <= HM_SPAN_SIZE) {
+				/* the header is written before bump covers it, recovery scans up to bump */
+				ptr = ((hm_shm_ptr)index<<HM_SPAN_SHIFT)+span->bump+HM_SHM_BLOCK;
+				hm_atomic_store(&hm_shm_block_of(shm, ptr)->owner, shm->slot+1);
+				hm_atomic_store(&span->bump, span->bump+size);
+				break;
+			}
+			shm->current[klass] = 0;
+			hm_shm_orphan(shm, index, 0);
+		}
+
+		hm_shm_lock(seg);
+		index = hm_shm_span_alloc(seg, 1, klass);
+		if(index)
+			seg->spans[index].owner = (u16)(shm->slot+1);
+		hm_shm_unlock(seg);
+		if(!index)
+			return 0;
+
+		shm->current[klass] = index;
+		shm->local[klass] = 0;
+	}
+
+	__atomic_add_fetch(&span->state, 1, __ATOMIC_ACQ_REL);
+	return ptr;
+}
+
+static hm_shm_ptr hm_shm_alloc_large(hm_shm* shm, size_t size)
+{
+	hm_shm_seg* seg = shm->seg;
+	hm_shm_block* block;
+	u32 index, count;
+
+	count = (u32)(hm_align_up(size+HM_SHM_BLOCK, HM_SPAN_SIZE)>>HM_SPAN_SHIFT);
+
+	hm_shm_lock(seg);
+	index = hm_shm_span_alloc(seg, count, HM_SHM_LARGE);
+	if(index) {
+		seg->spans[index].owner = (u16)(shm->slot+1);
+		hm_atomic_store(&seg->spans[index].state, 1);
+	}
+	hm_shm_unlock(seg);
+	if(!index)
+		return 0;
+
+	block = (hm_shm_block* )((char* )seg+((size_t)index<<HM_SPAN_SHIFT));
+	block->next = 0;
+	hm_atomic_store(&block->owner, shm->slot+1);
+	hm_atomic_store(&seg->spans[index].bump, (u32)HM_SPAN_SIZE);
+
+	return ((hm_shm_ptr)index<<HM_SPAN_SHIFT)+HM_SHM_BLOCK;
+}
+
+hm_shm_ptr hm_shm_alloc(hm_shm* shm, size_t size)
+{
+	hm_shm_ptr ptr;
+
+	if(size > HM_SMALL_MAX-HM_SHM_BLOCK) {
+		if(size >= ((size_t)shm->seg->nspans<<HM_SPAN_SHIFT))
+			return 0;
+		return hm_shm_alloc_large(shm, size);
+	}
+
+	hm_lock_acquire(&shm->lock);
+	ptr = hm_shm_pop(shm, hm_pool_class(size+HM_SHM_BLOCK));
+	hm_lock_release(&shm->lock);
+
+	return ptr;
+}
+
+/* called by any process, blocks of small spans go back without a lock */
+static void hm_shm_release(hm_shm* shm, hm_shm_ptr ptr, int locked)
+{
+	hm_shm_span* span;
+	hm_shm_ptr head;
+	u32 index;
+
+	index = hm_shm_index(ptr);
+	span = &shm->seg->spans[index];
+	if(span->klass == HM_SHM_LARGE) {
+		if(!locked)
+			hm_shm_lock(shm->seg);
+		hm_shm_span_release(shm->seg, index);
+		if(!locked)
+			hm_shm_unlock(shm->seg);
+		return;
+	}
+
+	head = __atomic_load_n(&span->free, __ATOMIC_RELAXED);
+	do {
+		hm_shm_block_of(shm, ptr)->next = head;
+	} while(!__atomic_compare_exchange_n(&span->free, &head, ptr, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	hm_shm_put(shm, index, locked);
+}
+
+void hm_shm_free(hm_shm* shm, hm_shm_ptr ptr)
+{
+	u32 owner;
+
+	if(!ptr)
+		return;
+
+	owner = __atomic_exchange_n(&hm_shm_block_of(shm, ptr)->owner, 0, __ATOMIC_ACQ_REL);
+	assert(owner);
+	if(owner)
+		hm_shm_release(shm, ptr, 0);
+}
+
+/* take over a block received from a peer, fails if recovery already reclaimed it */
+int hm_shm_adopt(hm_shm* shm, hm_shm_ptr ptr)
+{
+	hm_shm_block* block = hm_shm_block_of(shm, ptr);
+	u32 owner;
+
+	owner = hm_atomic_load(&block->owner);
+	if(!owner)
+		return -1;
+
+	return hm_atomic_cas(&block->owner, &owner, shm->slot+1) ? 0 : -1;
+}
+
+size_t hm_shm_usable_size(hm_shm* shm, hm_shm_ptr ptr)
+{
+	hm_shm_span* span;
+
+	if(!ptr)
+		return 0;
+
+	span = &shm->seg->spans[hm_shm_index(ptr)];
+	if(span->klass == HM_SHM_LARGE)
+		return ((size_t)span->run<<HM_SPAN_SHIFT)-HM_SHM_BLOCK;
+	return hm_pool_sizes[span->klass]-HM_SHM_BLOCK;
+}
+
+/* called with seg->lock held, so spans keep their class while scanned */
+static size_t hm_shm_reclaim(hm_shm* shm, u32 owner)
+{
+	hm_shm_seg* seg = shm->seg;
+	hm_shm_span* span;
+	hm_shm_block* block;
+	hm_shm_ptr base, ptr;
+	u32 index, bump, size, dead;
+	size_t count = 0;
+
+	for(index = seg->first; index < seg->nspans; index ++) {
+		span = &seg->spans[index];
+		if(!span->klass || (span->klass == HM_SHM_LARGE && !span->run))
+			continue;
+
+		base = (hm_shm_ptr)index<<HM_SPAN_SHIFT;
+		bump = hm_atomic_load(&span->bump);
+		size = span->klass == HM_SHM_LARGE ? HM_SPAN_SIZE : hm_pool_sizes[span->klass];
+		for(ptr = base+HM_SHM_BLOCK; ptr+size <= base+bump+HM_SHM_BLOCK; ptr += size) {
+			block = hm_shm_block_of(shm, ptr);
+			dead = owner;
+			if(hm_atomic_cas(&block->owner, &dead, 0)) {
+				hm_shm_release(shm, ptr, 1);
+				count ++;
+			}
+		}
+
+		if(span->klass && span->klass != HM_SHM_LARGE && span->owner == owner)
+			hm_shm_orphan(shm, index, 1);
+	}
+
+	return count;
+}
+
+/* reclaim blocks and spans of attached processes that died, returns the number of blocks */
+size_t hm_shm_recover(hm_shm* shm)
+{
+	hm_shm_seg* seg = shm->seg;
+	hm_shm_slot* slot;
+	size_t count = 0;
+	u32 index;
+	int pid;
+
+	for(index = 0; index < HM_SHM_SLOTS; index ++) {
+		slot = &seg->slots[index];
+		pid = hm_atomic_load(&slot->pid);
+		if(pid <= 0 || hm_os_alive(pid, slot->start))
+			continue;
+		if(!hm_atomic_cas(&slot->pid, &pid, -1))
+			continue;
+
+		hm_shm_lock(seg);
+		count += hm_shm_reclaim(shm, index+1);
+		hm_shm_unlock(seg);
+
+		slot->start = 0;
+		hm_atomic_store(&slot->pid, 0);
+	}
+
+	return count;
+}
+
+size_t hm_shm_spans(hm_shm* shm)
+{
+	hm_shm_seg* seg = shm->seg;
+	size_t count = 0;
+	u32 index;
+
+	hm_shm_lock(seg);
+	for(index = seg->first; index < seg->nspans; index ++) {
+		if(seg->spans[index].klass)
+			count ++;
+	}
+	hm_shm_unlock(seg);
+
+	return count;
+}
+
+/* blocks still allocated stay valid for the peers */
+void hm_shm_close(hm_shm* shm)
+{
+	u32 klass;
+
+	hm_lock_acquire(&shm->lock);
+	for(klass = 1; klass < hm_pool_classes; klass ++) {
+		if(shm->current[klass]) {
+			hm_shm_orphan(shm, shm->current[klass], 0);
+			shm->current[klass] = 0;
+		}
+	}
+	hm_lock_release(&shm->lock);
+
+	shm->seg->slots[shm->slot].start = 0;
+	hm_atomic_store(&shm->seg->slots[shm->slot].pid, 0);
+
+	hm_os_unmap(shm->seg, shm->size);
+	close(shm->fd);
+	k_free(shm);
+}
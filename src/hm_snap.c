@@ -0,0 +1,288 @@
+#include "hm_def.h"
+#include "hm_osi.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "hm_mem.h"
+#include "hm_snap.h"
+
+/* relocations read per pread while loading */
+#define HM_SNAP_BATCH	512
+
+hm_snap* hm_snap_create(void* base, size_t size)
+{
+	hm_snap* snap;
+
+	/* the size class table is part of the image, it has to be settled first */
+	if(hm_initialize())
+		return NULL;
+
+	size = hm_align_up(size, HM_CHUNK_SIZE);
+	if(!size || ((uintptr_t)base&HM_CHUNK_MASK))
+		return NULL;
+
+	snap = k_malloc(sizeof(hm_snap));
+	if(!snap)
+		return NULL;
+	memset(snap, 0, sizeof(hm_snap));
+
+	snap->mgr = k_malloc(sizeof(hm_mgr));
+	if(!snap->mgr)
+		goto fail;
+
+	snap->base = base ? hm_os_map_at(base, size) : hm_os_map_aligned(size, HM_CHUNK_SIZE);
+	if(!snap->base)
+		goto fail;
+	snap->size = size;
+
+	hm_mgr_init_range(snap->mgr, snap->base, size);
+	return snap;
+
+fail:
+	k_free(snap->mgr);
+	k_free(snap);
+	return NULL;
+}
+
+/* blocks are freed with hm_free() while the snapshot is built */
+void* hm_snap_alloc(hm_snap* snap, size_t size)
+{
+	if(!snap->mgr)
+		return NULL;
+
+	return hm_mgr_alloc(snap->mgr, size);
+}
+
+/* field holds a pointer into the snapshot, or NULL */
+int hm_snap_reloc(hm_snap* snap, void* field)
+{
+	size_t offset = (size_t)((char* )field-snap->base);
+	u64* relocs;
+
+	if(!snap->mgr || (char* )field < snap->base || offset+sizeof(void* ) > snap->size)
+		return -1;
+
+	if(snap->nrelocs == snap->maxrelocs) {
+		relocs = realloc(snap->relocs, (snap->maxrelocs ? snap->maxrelocs*2 : 256)*sizeof(u64));
+		if(!relocs)
+			return -1;
+		snap->relocs = relocs;
+		snap->maxrelocs = snap->maxrelocs ? snap->maxrelocs*2 : 256;
+	}
+
+	snap->relocs[snap->nrelocs ++] = offset;
+	return 0;
+}
+
+/* where a loaded snapshot is entered from */
+void hm_snap_set_root(hm_snap* snap, void* root)
+{
+	snap->root = root;
+}
+
+void* hm_snap_root(hm_snap* snap)
+{
+	return snap->root;
+}
+
+static int hm_snap_cmp(const void* a, const void* b)
+{
+	u64 x = *(const u64* )a, y = *(const u64* )b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* a field registered twice would be moved twice, keep each once and in order */
+static void hm_snap_unique(hm_snap* snap)
+{
+	size_t index, count;
+
+	if(!snap->nrelocs)
+		return;
+
+	qsort(snap->relocs, snap->nrelocs, sizeof(u64), hm_snap_cmp);
+	for(index = count = 1; index < snap->nrelocs; index ++) {
+		if(snap->relocs[index] != snap->relocs[count-1])
+			snap->relocs[count ++] = snap->relocs[index];
+	}
+	snap->nrelocs = count;
+}
+
+static int hm_snap_write(int fd, const void* buf, size_t size)
+{
+	ssize_t n;
+
+	while(size) {
+		n = write(fd, buf, size);
+		if(n <= 0)
+			return -1;
+		buf = (const char* )buf+n;
+		size -= (size_t)n;
+	}
+	return 0;
+}
+
+/*
+ * chunks are written with their headers frozen, so hm_free() of a block of
+ * the mapped snapshot does nothing. no allocation may run meanwhile.
+ */
+int hm_snap_save(hm_snap* snap, const char* path)
+{
+	char page[HM_PAGE_SIZE];
+	hm_snap_head* head = (hm_snap_head* )page;
+	hm_chunk *chunk, *frozen;
+	char *pos, *end;
+	int fd, ret = -1;
+
+	if(!snap->mgr)
+		return -1;
+
+	frozen = k_malloc(HM_CHUNK_HEADER);
+	if(!frozen)
+		return -1;
+
+	fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+	if(fd < 0) {
+		k_free(frozen);
+		return -1;
+	}
+
+	hm_snap_unique(snap);
+	end = snap->base+__atomic_load_n(&snap->mgr->used, __ATOMIC_ACQUIRE);
+	memset(page, 0, sizeof(page));
+	head->magic = HM_SNAP_MAGIC;
+	head->version = HM_SNAP_VERSION;
+	head->base = (u64)(uintptr_t)snap->base;
+	head->size = (u64)(end-snap->base);
+	head->root = snap->root ? (u64)((char* )snap->root-snap->base) : 0;
+	head->relocs = snap->nrelocs;
+	head->table = hm_pool_signature();
+	if(hm_snap_write(fd, page, sizeof(page)))
+		goto out;
+
+	for(pos = snap->base; pos < end; pos += chunk->size) {
+		chunk = (hm_chunk* )pos;
+		memcpy(frozen, chunk, HM_CHUNK_HEADER);
+		flag_set(frozen, HM_CHUNK_FROZEN);
+		frozen->mgr = NULL;
+		memset(&frozen->list, 0, sizeof(list_t));
+
+		if(hm_snap_write(fd, frozen, HM_CHUNK_HEADER) ||
+			hm_snap_write(fd, pos+HM_CHUNK_HEADER, chunk->size-HM_CHUNK_HEADER))
+			goto out;
+	}
+
+	if(hm_snap_write(fd, snap->relocs, snap->nrelocs*sizeof(u64)))
+		goto out;
+	ret = 0;
+
+out:
+	if(close(fd))
+		ret = -1;
+	k_free(frozen);
+	return ret;
+}
+
+/*
+ * move the registered fields by delta, the range is still writable. the
+ * offsets are ascending and unique, see hm_snap_unique().
+ */
+static int hm_snap_relocate(int fd, hm_snap_head* head, char* base)
+{
+	u64 relocs[HM_SNAP_BATCH];
+	size_t offset, count, index;
+	u64 next = 0;
+	uintptr_t* field;
+	intptr_t delta;
+	ssize_t n;
+
+	delta = (intptr_t)base-(intptr_t)head->base;
+	offset = HM_PAGE_SIZE+head->size;
+	for(count = 0; count < head->relocs; count += index) {
+		n = pread(fd, relocs, sizeof(relocs), (off_t)(offset+count*sizeof(u64)));
+		if(n < (ssize_t)sizeof(u64))
+			return -1;
+
+		for(index = 0; index < (size_t)n/sizeof(u64) && count+index < head->relocs; index ++) {
+			if(relocs[index] < next || relocs[index]+sizeof(uintptr_t) > head->size)
+				return -1;
+			next = relocs[index]+sizeof(uintptr_t);
+			field = (uintptr_t* )(base+relocs[index]);
+			/* NULL and whatever does not point into the snapshot stay */
+			if(*field-head->base < head->size)
+				*field += (uintptr_t)delta;
+		}
+	}
+	return 0;
+}
+
+/*
+ * map a snapshot back, at the base it was built at when that is free.
+ * pages are shared with the page cache until written, relocated ones are
+ * copied. without HM_SNAP_COW the snapshot is read only.
+ */
+hm_snap* hm_snap_load(const char* path, u32 flags)
+{
+	hm_snap_head head;
+	hm_snap* snap;
+	char* base;
+	int fd, moved;
+
+	if(hm_initialize())
+		return NULL;
+
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if(fd < 0)
+		return NULL;
+	if(pread(fd, &head, sizeof(head), 0) != (ssize_t)sizeof(head) ||
+		head.magic != HM_SNAP_MAGIC || head.version != HM_SNAP_VERSION ||
+		head.table != hm_pool_signature() || !head.size ||
+		(head.size&HM_CHUNK_MASK) || (head.base&HM_CHUNK_MASK))
+		goto fail;
+
+	snap = k_malloc(sizeof(hm_snap));
+	if(!snap)
+		goto fail;
+	memset(snap, 0, sizeof(hm_snap));
+
+	base = hm_os_map_at((void* )(uintptr_t)head.base, head.size);
+	if(!base && !(flags&HM_SNAP_FIXED))
+		base = hm_os_map_aligned(head.size, HM_CHUNK_SIZE);
+	if(!base)
+		goto fail_snap;
+
+	moved = (uintptr_t)base != head.base;
+	if(!hm_os_map_file(fd, base, head.size, HM_PAGE_SIZE, moved || (flags&HM_SNAP_COW)))
+		goto fail_map;
+	if(moved) {
+		if(hm_snap_relocate(fd, &head, base))
+			goto fail_map;
+		if(!(flags&HM_SNAP_COW))
+			hm_os_readonly(base, head.size);
+	}
+
+	snap->base = base;
+	snap->size = head.size;
+	snap->root = head.root ? base+head.root : NULL;
+	close(fd);
+	return snap;
+
+fail_map:
+	hm_os_unmap(base, head.size);
+fail_snap:
+	k_free(snap);
+fail:
+	close(fd);
+	return NULL;
+}
+
+/* every block of the snapshot goes away with it */
+void hm_snap_close(hm_snap* snap)
+{
+	hm_os_unmap(snap->base, snap->size);
+	free(snap->relocs);
+	k_free(snap->mgr);
+	k_free(snap);
+}
@@ -4,33 +4,92 @@
 #include "hm_mem.h"
 #include "hm_task.h"
 
-static dlist_t hm_tasks[HM_TASK_MAX] = { 0 };
+/* empty hlist heads are all zero, the registry needs no setup */
+static hlist_t hm_tasks[HM_TASK_MAX];
+static hm_lock hm_tasks_lock = HM_LOCK_INIT;
+static pthread_key_t hm_task_key;
+
+/* reservation applied to every task when it registers, under hm_tasks_lock */
+static size_t hm_task_reserved[HM_CLASS_MAX];
+static u32 hm_task_reserve_flags;
+static int hm_task_reserving;
+
+HM_TLS hm_task* hm_task_local;
 
 #define HM_TASK_HEAD(i) hm_task_head(hm_tasks, i)
 
-int hm_task_initialize()
+static void hm_task_release(hm_task* task)
+{
+	hm_lock_acquire(&hm_tasks_lock);
+	hlist_del(&task->list);
+	hm_lock_release(&hm_tasks_lock);
+
+	hm_ebr_release(&task->ebr);
+	hm_mem_release(&task->mem);
+	/* what it still holds, blocks other tasks freed, leaves the group with it */
+	hm_budget_join(&task->budget, NULL);
+	k_free(task);
+}
+
+/* thread exit */
+static void hm_task_destroy(void* arg)
 {
-	int index;
+	hm_task* task = arg;
 
-	for(index = 0; index < HM_TASK_MAX; index ++)
-		dlist_init_head(HM_TASK_HEAD(index));
+	if(task == hm_task_local)
+		hm_task_local = NULL;
+	if(hm_mem_local == &task->mem)
+		hm_mem_local = NULL;
+	hm_task_release(task);
+}
+
+int hm_task_initialize()
+{
+	return pthread_key_create(&hm_task_key, hm_task_destroy) ? -1 : 0;
 }
 
 int hm_task_register()
 {
-	int index;
-	dlist_t *head, *pos;
+	size_t reserved[HM_CLASS_MAX];
 	hm_atom atom;
 	hm_task* task;
-	
+	u32 flags;
+	int reserving;
+
+	/* the first allocation of the process sets the allocator up */
+	if(hm_initialize())
+		return -1;
+	/* an allocation already registered the calling thread */
+	if(hm_task_local)
+		return 0;
+
 	atom = hm_atom_current();
 	assert(!hm_task_search(atom));
 
 	task = k_malloc(sizeof(hm_task));
 	if(task) {
 		task->id = atom;
-		if(!hm_mem_init(&task->mem)) {
-			dlist_add((dlist_t* )task, HM_TASK_HEAD(hm_atom_hashcode(atom)));
+		if(!hm_mem_init(&task->mem, 0, task->bins, task->remote)) {
+			hm_ebr_init(&task->ebr);
+			hm_budget_init(&task->budget);
+			hm_lock_acquire(&hm_tasks_lock);
+			hlist_add_head(&task->list, HM_TASK_HEAD(hm_atom_hashcode(atom)));
+			reserving = hm_task_reserving;
+			if(reserving) {
+				memcpy(reserved, hm_task_reserved, sizeof(reserved));
+				flags = hm_task_reserve_flags;
+			}
+			hm_lock_release(&hm_tasks_lock);
+
+			hm_task_local = task;
+			/* a context switched to before the first allocation stays current */
+			if(!hm_mem_local)
+				hm_mem_local = &task->mem;
+			pthread_setspecific(hm_task_key, task);
+
+			/* take the first touch faults here rather than on the first allocations */
+			if(reserving)
+				hm_mem_reserve(&task->mem, reserved, flags);
 			return 0;
 		}
 		else
@@ -40,18 +99,114 @@ int hm_task_register()
 	return -1;
 }
 
+int hm_task_unregister()
+{
+	hm_task* task = hm_task_local;
+
+	if(!task)
+		return -1;
+
+	pthread_setspecific(hm_task_key, NULL);
+	hm_task_local = NULL;
+	if(hm_mem_local == &task->mem)
+		hm_mem_local = NULL;
+	hm_task_release(task);
+	return 0;
+}
+
+/* bytes is indexed by size class, see hm_pool_class() */
+int hm_task_reserve(const size_t* bytes, u32 flags)
+{
+	hm_task* task = hm_task_self();
+
+	if(!task)
+		return -1;
+
+	return hm_mem_reserve(&task->mem, bytes, flags);
+}
+
+/* applies to the threads registering after it, NULL turns it off */
+int hm_task_set_reserve(const size_t* bytes, u32 flags)
+{
+	hm_lock_acquire(&hm_tasks_lock);
+	hm_task_reserving = bytes != NULL;
+	if(bytes) {
+		memcpy(hm_task_reserved, bytes, sizeof(hm_task_reserved));
+		hm_task_reserve_flags = flags;
+	}
+	hm_lock_release(&hm_tasks_lock);
+	return 0;
+}
+
+/* after the caller moved to another numa node, 1 if it did */
+int hm_task_rebind()
+{
+	hm_task* task = hm_task_self();
+
+	if(!task)
+		return -1;
+
+	return hm_mem_rebind(&task->mem);
+}
+
+/* limits on the bytes the calling task holds, see hm_budget */
+int hm_task_set_budget(size_t soft, size_t hard, hm_budget_callback callback, void* arg)
+{
+	hm_task* task = hm_task_self();
+
+	if(!task)
+		return -1;
+
+	task->budget.limit.soft = soft;
+	task->budget.limit.hard = hard;
+	task->budget.limit.callback = callback;
+	task->budget.limit.arg = arg;
+	task->budget.limit.crossed = 0;
+	return 0;
+}
+
+/* the group has to outlive the task, NULL leaves it */
+int hm_task_set_group(hm_group* group)
+{
+	hm_task* task = hm_task_self();
+
+	if(!task)
+		return -1;
+
+	hm_budget_join(&task->budget, group);
+	return 0;
+}
+
+s64 hm_task_usage()
+{
+	hm_task* task = hm_task_self();
+
+	return task ? task->budget.bytes : 0;
+}
+
+hm_task* hm_task_attach()
+{
+	if(hm_task_register())
+		return NULL;
+
+	return hm_task_local;
+}
+
 hm_task* hm_task_search(hm_atom atom)
 {
 	hm_task* task;
-	dlist_t *pos, 
-		*head = HM_TASK_HEAD(hm_atom_hashcode(atom));
-	
-	dlist_for_each(pos, head) {
-		task = (hm_task* )pos;
-		if(!hm_atom_compare(task->atom, atom))
-			return task;
+	hlist_node_t* pos;
+	hlist_t* head = HM_TASK_HEAD(hm_atom_hashcode(atom));
+
+	task = NULL;
+	hm_lock_acquire(&hm_tasks_lock);
+	hlist_for_each(pos, head) {
+		if(!hm_atom_compare(((hm_task* )pos)->id, atom)) {
+			task = (hm_task* )pos;
+			break;
+		}
 	}
+	hm_lock_release(&hm_tasks_lock);
 
-	return NULL;
+	return task;
 }
-
@@ -0,0 +1,78 @@
+#ifndef HM_BUDGET_H
+#define HM_BUDGET_H
+
+#include "hm_osi.h"
+#include "hm_types.h"
+
+/* group usage is spread over this many counters, one cache line each */
+#define HM_BUDGET_SHARDS	16
+#define HM_BUDGET_LINE		64
+/*
+ * a task sums the shards after charging this much, or on every charge once
+ * the last sum is within a slice per shard of the group's lowest limit
+ */
+#define HM_BUDGET_SLICE		(256u<<10)
+
+/* limits passed to the callback, 0 disables a limit */
+#define HM_BUDGET_SOFT	1
+#define HM_BUDGET_HARD	2
+
+/*
+ * called on the thread whose refill crossed a limit, after its caches
+ * went back to the manager. group is NULL for the limits of a task.
+ */
+typedef void (*hm_budget_callback)(hm_group* group, u32 events, s64 usage, void* arg);
+
+typedef struct hm_budget_limit_s {
+	size_t soft;
+	size_t hard;
+	hm_budget_callback callback;
+	void* arg;
+	/* the limits usage was over last time it was looked at */
+	u32 crossed;
+}hm_budget_limit;
+
+typedef struct hm_budget_shard_s {
+	s64 bytes;
+}__attribute__((aligned(HM_BUDGET_LINE))) hm_budget_shard;
+
+struct hm_group_s {
+	hm_budget_limit limit;
+	/* the last sum of the shards */
+	hm_budget_shard usage;
+	hm_budget_shard shards[HM_BUDGET_SHARDS];
+};
+
+/*
+ * bytes a task took from the manager and did not give back. it changes on
+ * cache refills and flushes and on large blocks only, never on the fast
+ * path. blocks freed by another task count for that one, so a consumer
+ * may well go negative.
+ */
+typedef struct hm_budget_s {
+	s64 bytes;
+	/* charged to the group since the task last summed its shards */
+	s64 unchecked;
+	u32 shard;
+	hm_budget_limit limit;
+	hm_group* group;
+}hm_budget;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void hm_budget_init(hm_budget* budget);
+void hm_budget_join(hm_budget* budget, hm_group* group);
+int hm_budget_charge(hm_budget* budget, hm_mem* mem, size_t bytes);
+void hm_budget_uncharge(hm_budget* budget, size_t bytes);
+
+hm_group* hm_group_create(size_t soft, size_t hard, hm_budget_callback callback, void* arg);
+void hm_group_destroy(hm_group* group);
+s64 hm_group_usage(hm_group* group);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
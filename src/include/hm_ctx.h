@@ -0,0 +1,47 @@
+#ifndef HM_CTX_H
+#define HM_CTX_H
+
+#include "hm_task.h"
+
+/* refills of a context are a sixteenth of a task's */
+#define HM_CTX_SHIFT	4
+
+/*
+ * allocation context of a fiber or coroutine. it is not tied to a thread,
+ * the scheduler switches it in wherever the fiber runs next, one thread at
+ * a time. its bins are only there while it holds blocks, see hm_mem.
+ */
+struct hm_ctx_s {
+	hm_mem mem;
+};
+
+extern HM_TLS hm_ctx* hm_ctx_local;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+hm_ctx* hm_ctx_create();
+void hm_ctx_destroy(hm_ctx* ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* the context allocations of the calling thread come from, NULL for its task */
+static __inline hm_ctx* hm_ctx_current()
+{
+	return hm_ctx_local;
+}
+
+/* make ctx current, NULL goes back to the thread's own task. returns the previous one */
+static __inline hm_ctx* hm_ctx_switch(hm_ctx* ctx)
+{
+	hm_ctx* prev = hm_ctx_local;
+
+	hm_ctx_local = ctx;
+	hm_mem_local = ctx ? &ctx->mem : hm_task_local ? &hm_task_local->mem : NULL;
+	return prev;
+}
+
+#endif
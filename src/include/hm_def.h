@@ -1,5 +1,55 @@
 #ifndef HM_DEF_H
 #define HM_DEF_H
 
-#endif
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stddef.h"
+
+#define HM_PAGE_SHIFT	12
+#define HM_PAGE_SIZE	(1ul<<HM_PAGE_SHIFT)
+
+/* a span is the unit a pool carves into equally sized blocks */
+#define HM_SPAN_SHIFT	16
+#define HM_SPAN_SIZE	(1ul<<HM_SPAN_SHIFT)
+#define HM_SPAN_MASK	(HM_SPAN_SIZE-1)
+
+/* chunks are mapped from the os aligned to their size, the header lives in span 0 */
+#define HM_CHUNK_SHIFT	22
+#define HM_CHUNK_SIZE	(1ul<<HM_CHUNK_SHIFT)
+#define HM_CHUNK_MASK	(HM_CHUNK_SIZE-1)
+#define HM_CHUNK_SPANS	(HM_CHUNK_SIZE>>HM_SPAN_SHIFT)
+
+#define HM_ALIGN		16
+#define HM_SMALL_MAX	(32u<<10)
+
+/* size classes, class 0 is reserved for "not a pool" */
+#define HM_CLASS_MAX	64
+#define HM_CLASS_LOOKUP	(((HM_SMALL_MAX+127)>>7)+57)
 
+/* bytes moved between a task cache and the manager per refill */
+#define HM_BATCH_BYTES	(8u<<10)
+#define HM_BATCH_MIN	2
+#define HM_BATCH_MAX	64
+
+/* dirty spans kept by the manager before purging */
+#define HM_DIRTY_MAX	64
+
+/*
+ * freed large mappings are cached by length, four buckets per power of two
+ * from 32 KiB to 128 MiB. an arena keeps up to HM_LARGE_CACHE bytes of them.
+ */
+#define HM_LARGE_SHIFT	15
+#define HM_LARGE_BUCKETS	48
+#define HM_LARGE_CACHE	(128ul<<20)
+
+/* numa nodes with their own arena, higher nodes share them */
+#define HM_NODE_MAX	8
+
+#define hm_align_up(x, a) (((x)+((a)-1))&~((a)-1))
+#define hm_align_down(x, a) ((x)&~((a)-1))
+
+#define hm_likely(x) __builtin_expect(!!(x), 1)
+#define hm_unlikely(x) __builtin_expect(!!(x), 0)
+
+#endif
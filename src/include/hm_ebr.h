@@ -0,0 +1,63 @@
+#ifndef HM_EBR_H
+#define HM_EBR_H
+
+#include "hm_osi.h"
+#include "hm_types.h"
+#include "list.h"
+
+/* a block retired in epoch e is freed once the global epoch reaches e+2 */
+#define HM_EBR_EPOCHS	3
+#define HM_EBR_BAG		61
+/* deferred frees between two attempts to advance the epoch */
+#define HM_EBR_BATCH	128
+
+/* retired pointers, the blocks themselves stay untouched until freed */
+typedef struct hm_ebr_bag_s {
+	struct hm_ebr_bag_s* next;
+	u64 epoch;
+	u32 count;
+	void* ptrs[HM_EBR_BAG];
+}hm_ebr_bag;
+
+typedef struct hm_limbo_s {
+	hm_ebr_bag* bags;
+	u64 epoch;
+	u32 count;
+}hm_limbo;
+
+/*
+ * epoch is the global epoch the task last announced, 0 while it is
+ * quiescent. only the owning task writes it, with plain stores.
+ */
+typedef struct hm_ebr_s {
+	u64 epoch;
+	u32 nest;
+	u32 pending;
+	list_t list;
+	hm_limbo limbo[HM_EBR_EPOCHS];
+}hm_ebr;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int hm_ebr_initialize();
+void hm_ebr_init(hm_ebr* ebr);
+void hm_ebr_release(hm_ebr* ebr);
+
+/* critical sections, they nest */
+void hm_ebr_enter();
+void hm_ebr_exit();
+
+/* quiescent state based use, the task stays online between reports */
+void hm_ebr_quiescent();
+void hm_ebr_offline();
+
+void hm_free_deferred(void* ptr);
+size_t hm_ebr_reclaim();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef HM_GUARD_H
+#define HM_GUARD_H
+
+#include "hm_mgr.h"
+
+/* slots fit in one chunk, a guard page on either side of each */
+#define HM_GUARD_SLOTS_MAX	(((HM_CHUNK_SIZE-HM_CHUNK_HEADER)/HM_PAGE_SIZE-1)/2)
+#define HM_GUARD_DEPTH		16
+/* allocations between checks of the sampling settings while sampling is off */
+#define HM_GUARD_IDLE		(1u<<16)
+
+/* slot states */
+#define HM_GUARD_FREE	0
+#define HM_GUARD_LIVE	1
+#define HM_GUARD_FREED	2
+
+typedef struct hm_guard_trace_s {
+	int tid;
+	int depth;
+	void* stack[HM_GUARD_DEPTH];
+}hm_guard_trace;
+
+/* a page sized allocation between two guard pages */
+typedef struct hm_guard_slot_s {
+	char* ptr;
+	size_t size;
+	u32 state;
+	hm_guard_trace alloc;
+	hm_guard_trace free;
+}hm_guard_slot;
+
+typedef struct hm_guard_info_s {
+	size_t sampled;
+	size_t live;
+	size_t slots;
+	size_t full;
+}hm_guard_info;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int hm_guard_initialize();
+int hm_guard_enable(u32 rate, u32 slots);
+void hm_guard_disable();
+u32 hm_guard_next();
+int hm_guard_due();
+
+void* hm_guard_alloc(size_t size);
+void hm_guard_free(void* ptr);
+size_t hm_guard_usable_size(const void* ptr);
+void hm_guard_stats(hm_guard_info* info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
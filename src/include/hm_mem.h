@@ -0,0 +1,67 @@
+#ifndef HM_MEM_H
+#define HM_MEM_H
+
+#include "hm_mgr.h"
+
+/* per task free list of one size class */
+typedef struct hm_bin_s {
+	void* head;
+	u32 count;
+	u32 max;
+}hm_bin;
+
+/*
+ * a light cache, one without remote bins, takes its bins on first use and
+ * gives them back on hm_mem_release(). its frees of other nodes' blocks go
+ * through the task running it.
+ */
+struct hm_mem_s {
+	hm_mgr* mgr;
+	u32 node;
+	/* refills are cut down by this for light caches */
+	u32 shift;
+	hm_bin* bins;
+	/* freed blocks of other nodes, batched back to their arenas */
+	hm_bin* remote;
+	/* the last hm_mem_trim() the cache was drained for */
+	u32 trim;
+};
+
+/* the cache the calling thread allocates from, its task's or a context's */
+extern HM_TLS hm_mem* hm_mem_local;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int hm_initialize();
+
+int hm_mem_init(hm_mem* mem, u32 shift, hm_bin* bins, hm_bin* remote);
+void hm_mem_release(hm_mem* mem);
+void hm_mem_drain(hm_mem* mem);
+void* hm_mem_alloc(hm_mem* mem, size_t size);
+void hm_mem_free(hm_mem* mem, void* ptr);
+void hm_mem_flush(hm_mem* mem, u32 klass, u32 count);
+int hm_mem_reserve(hm_mem* mem, const size_t* bytes, u32 flags);
+int hm_mem_rebind(hm_mem* mem);
+
+/*
+ * returns free memory to the os. only the caller's caches are drained
+ * now, bins are not locked. other threads drain theirs on their next
+ * refill, an idle one keeps its cached blocks, and the spans under them,
+ * until one of its bins runs empty, it calls hm_mem_trim() itself or it
+ * exits.
+ */
+size_t hm_mem_trim();
+
+void* hm_malloc(size_t size);
+void* hm_calloc(size_t count, size_t size);
+void* hm_realloc(void* ptr, size_t size);
+void hm_free(void* ptr);
+size_t hm_usable_size(const void* ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,7 +1,150 @@
 #ifndef HM_MGR_H
 #define HM_MGR_H
 
+#include "hm_osi.h"
 #include "hm_pool.h"
 
+#define HM_CHUNK_MAGIC	0x686d6368u
+
+/* hm_mgr_prefault flags, pinned spans are never purged */
+#define HM_PREFAULT_PIN	flag_bit(0)
+
+/* chunk kinds */
+#define HM_CHUNK_POOL	1
+#define HM_CHUNK_LARGE	2
+#define HM_CHUNK_GUARD	3
+
+/* chunk flags, nothing in a frozen chunk is ever freed, see hm_snap */
+#define HM_CHUNK_FROZEN	flag_bit(0)
+
+struct hm_chunk_s {
+	u32 magic;
+	u32 kind;
+	u32 node;
+	u32 flags;
+	hm_mgr* mgr;
+	list_t list;
+	size_t size;
+	/* of a large chunk, the bytes its block reaches, pages past it are clean */
+	size_t length;
+	/* of a pool chunk, its spans on arena->clean, under the arena lock */
+	u32 clean;
+	hm_pool pools[HM_CHUNK_SPANS];
+};
+
+/* large objects start on the first page after the chunk header */
+#define HM_CHUNK_HEADER hm_align_up(sizeof(hm_chunk), HM_PAGE_SIZE)
+
+/* partial pools of a class by occupancy, refills take the fullest first */
+#define HM_CLASS_BINS	4
+
+/* central free lists of one size class */
+typedef struct hm_class_s {
+	hm_lock lock;
+	list_t pools[HM_CLASS_BINS];
+	u32 batch;
+}hm_class;
+
+typedef struct hm_stats_s {
+	size_t mapped;
+	size_t spans;
+	size_t spans_dirty;
+	size_t spans_clean;
+	size_t spans_pinned;
+	size_t large;
+	size_t large_bytes;
+	size_t large_cached;
+	size_t large_cached_bytes;
+	/* process wide, filled in by hm_mgr_stats() only */
+	u64 mmaps;
+	u64 munmaps;
+	u64 madvises;
+	u64 mprotects;
+}hm_stats;
+
+/* span occupancy in tenths, the last bucket holds the full spans */
+#define HM_FRAG_BUCKETS	11
+
+/* how well the spans of one size class are used */
+typedef struct hm_frag_s {
+	u32 size;
+	size_t spans;
+	/* blocks handed out, the ones sitting in task caches included */
+	size_t used;
+	/* span bytes not in a used block */
+	size_t wasted;
+	size_t histogram[HM_FRAG_BUCKETS];
+}hm_frag;
+
+/* spans and central lists of one numa node */
+typedef struct hm_arena_s {
+	hm_lock lock;
+	u32 node;
+	list_t chunks;
+	list_t dirty;
+	list_t clean;
+	list_t pinned;
+	/* dirty spans prefaulted without a pin, releases do not purge them */
+	size_t reserve;
+	hm_stats stats;
+	hm_class classes[HM_CLASS_MAX];
+	/* freed large mappings by length, see hm_large_bucket() */
+	list_t large[HM_LARGE_BUCKETS];
+}hm_arena;
+
+/* a single arena on machines without numa */
+struct hm_mgr_s {
+	u32 nodes;
+	/* chunks are carved from this range instead of mapped when set, see hm_snap */
+	char* base;
+	size_t size;
+	size_t used;
+	hm_arena arenas[HM_NODE_MAX];
+};
+
+/* all zero, with no nodes, until hm_initialize() sets it up */
+extern hm_mgr hm_mgr_main;
+
+static __inline hm_chunk* hm_chunk_of(const void* ptr)
+{
+	return (hm_chunk* )hm_align_down((uintptr_t)ptr, HM_CHUNK_SIZE);
+}
+
+static __inline hm_pool* hm_chunk_pool(hm_chunk* chunk, const void* ptr)
+{
+	return &chunk->pools[((uintptr_t)ptr&HM_CHUNK_MASK)>>HM_SPAN_SHIFT];
+}
+
+static __inline hm_arena* hm_chunk_arena(hm_chunk* chunk)
+{
+	return &chunk->mgr->arenas[chunk->node];
+}
+
+#ifdef __cplusplus
+extern "C" {
 #endif
 
+int hm_mgr_init(hm_mgr* mgr);
+int hm_mgr_init_range(hm_mgr* mgr, void* base, size_t size);
+u32 hm_mgr_node(hm_mgr* mgr);
+u32 hm_mgr_refill(hm_mgr* mgr, u32 node, u32 klass, void** head, u32 count);
+void hm_mgr_flush(hm_mgr* mgr, u32 klass, void* head);
+void hm_mgr_purge(hm_mgr* mgr, size_t keep);
+size_t hm_mgr_trim(hm_mgr* mgr);
+int hm_mgr_prefault(hm_mgr* mgr, u32 node, size_t bytes, u32 flags);
+
+void* hm_mgr_alloc(hm_mgr* mgr, size_t size);
+void hm_mgr_free(hm_mgr* mgr, void* ptr);
+void* hm_mgr_alloc_large(hm_mgr* mgr, u32 node, size_t size);
+void hm_mgr_free_large(hm_mgr* mgr, hm_chunk* chunk);
+size_t hm_mgr_usable_size(const void* ptr);
+
+void hm_mgr_stats(hm_mgr* mgr, hm_stats* stats);
+void hm_mgr_node_stats(hm_mgr* mgr, u32 node, hm_stats* stats);
+void hm_mgr_frag(hm_mgr* mgr, hm_frag* frag);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
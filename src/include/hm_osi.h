@@ -1,5 +1,98 @@
 #ifndef HM_OSI_H
 #define HM_OSI_H
 
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "hm_def.h"
+
+typedef pthread_t hm_atom;
+
+#define hm_atom_current() pthread_self()
+#define hm_atom_compare(a, b) (!pthread_equal((a), (b)))
+
+static __inline ulong hm_atom_hashcode(hm_atom atom)
+{
+	ulong code = (ulong)atom;
+
+	return (code>>HM_PAGE_SHIFT)^(code>>(HM_PAGE_SHIFT+10));
+}
+
+#define HM_TLS __thread __attribute__((tls_model("initial-exec")))
+
+/* allocator metadata comes from the system heap */
+#define k_malloc malloc
+#define k_free free
+
+#define hm_atomic_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define hm_atomic_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define hm_atomic_add(p, v) __atomic_add_fetch((p), (v), __ATOMIC_RELAXED)
+#define hm_atomic_sub(p, v) __atomic_sub_fetch((p), (v), __ATOMIC_RELAXED)
+#define hm_atomic_cas(p, o, n) \
+	__atomic_compare_exchange_n((p), (o), (n), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+/* memory syscalls made through hm_os_*, counted process wide */
+#define HM_OS_MMAP		0
+#define HM_OS_MUNMAP	1
+#define HM_OS_MADVISE	2
+#define HM_OS_MPROTECT	3
+#define HM_OS_CALLS		4
+
+extern u64 hm_os_calls[HM_OS_CALLS];
+
+typedef struct hm_lock_s {
+	int locked;
+}hm_lock;
+
+#define HM_LOCK_INIT { 0 }
+
+static __inline void hm_lock_init(hm_lock* lock)
+{
+	lock->locked = 0;
+}
+
+static __inline void hm_lock_acquire(hm_lock* lock)
+{
+	while(__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE)) {
+		while(__atomic_load_n(&lock->locked, __ATOMIC_RELAXED))
+			sched_yield();
+	}
+}
+
+static __inline void hm_lock_release(hm_lock* lock)
+{
+	__atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+#ifdef __cplusplus
+extern "C" {
 #endif
 
+void* hm_os_map(size_t size);
+void* hm_os_map_aligned(size_t size, size_t align);
+void hm_os_unmap(void* addr, size_t size);
+void hm_os_purge(void* addr, size_t size);
+int hm_os_protect(void* addr, size_t size, int rw);
+int hm_os_readonly(void* addr, size_t size);
+void* hm_os_map_at(void* addr, size_t size);
+void* hm_os_map_file(int fd, void* addr, size_t size, size_t offset, int writable);
+void hm_os_populate(void* addr, size_t size);
+
+u32 hm_os_nodes();
+u32 hm_os_node();
+int hm_os_bind(void* addr, size_t size, u32 node);
+
+int hm_os_shm_create(const char* name, size_t size);
+int hm_os_shm_open(const char* name, size_t* size);
+void* hm_os_map_shared(int fd, size_t size);
+u64 hm_os_start(int pid);
+int hm_os_alive(int pid, u64 start);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
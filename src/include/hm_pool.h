@@ -1,8 +1,84 @@
 #ifndef HM_POOL_H
 #define HM_POOL_H
 
-#include <hm_types.h>
+#include "hm_osi.h"
+#include "hm_types.h"
 #include "list.h"
 
+/* pool flags */
+#define HM_POOL_FULL	flag_bit(0)
+#define HM_POOL_PURGED	flag_bit(1)
+#define HM_POOL_PINNED	flag_bit(2)
+
+/* a span carved into blocks of one size class */
+struct hm_pool_s {
+	list_t list;
+	void* free;
+	char* base;
+	char* bump;
+	char* end;
+	u32 size;
+	u32 used;
+	u32 total;
+	u16 klass;
+	u16 flags;
+};
+
+/* requested sizes in HM_ALIGN steps, the last bucket counts everything larger */
+#define HM_PROFILE_BUCKETS	(HM_SMALL_MAX/HM_ALIGN+2)
+
+extern u32 hm_pool_classes;
+extern u32 hm_pool_sizes[HM_CLASS_MAX];
+extern u8 hm_pool_lookup[HM_CLASS_LOOKUP];
+
+extern int hm_pool_profiling;
+extern u64 hm_pool_profile[HM_PROFILE_BUCKETS];
+
+/* allocations until the next one takes the sampled path, profiling and guard pages */
+extern HM_TLS u32 hm_pool_countdown;
+
+static __inline u32 hm_pool_index(size_t size)
+{
+	if(size <= 1024)
+		return (u32)((size+15)>>4);
+	return (u32)((size+127+(56<<7))>>7);
+}
+
+static __inline u32 hm_pool_class(size_t size)
+{
+	return hm_pool_lookup[hm_pool_index(size)];
+}
+
+static __inline int hm_pool_full(hm_pool* pool)
+{
+	return !pool->free && pool->bump == pool->end;
+}
+
+static __inline void hm_pool_push(hm_pool* pool, void* block)
+{
+	*(void** )block = pool->free;
+	pool->free = block;
+	pool->used --;
+}
+
+#ifdef __cplusplus
+extern "C" {
 #endif
 
+int hm_pool_initialize();
+int hm_pool_setup(const u32* sizes, u32 count);
+int hm_pool_load(const char* path);
+u32 hm_pool_signature();
+void hm_pool_init(hm_pool* pool, u32 klass);
+u32 hm_pool_pop(hm_pool* pool, void** head, u32 count);
+
+void hm_pool_profile_start();
+void hm_pool_profile_stop();
+void hm_pool_record(size_t size);
+int hm_pool_profile_dump(const char* path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
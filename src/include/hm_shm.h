@@ -0,0 +1,103 @@
+#ifndef HM_SHM_H
+#define HM_SHM_H
+
+#include "hm_osi.h"
+#include "hm_pool.h"
+
+/*
+ * pools in a segment shared by several processes. the segment may sit at a
+ * different address in every process, so blocks are named by hm_shm_ptr,
+ * their offset from the segment base, and no metadata holds a pointer.
+ */
+
+#define HM_SHM_MAGIC	0x686d7368u
+#define HM_SHM_VERSION	2
+#define HM_SHM_SLOTS	64
+
+/* span state, live block count plus the orphan bit */
+#define HM_SHM_ORPHAN	0x80000000u
+#define HM_SHM_LARGE	0xffffu
+
+typedef u64 hm_shm_ptr;
+
+/* a process attached to the segment */
+typedef struct hm_shm_slot_s {
+	int pid;
+	u32 reserved;
+	u64 start;
+}hm_shm_slot;
+
+typedef struct hm_shm_span_s {
+	u64 free;
+	u32 state;
+	u32 bump;
+	u32 run;
+	u16 klass;
+	u16 owner;
+}hm_shm_span;
+
+/* in front of every block, owner is the slot index plus one, 0 when free */
+typedef struct hm_shm_block_s {
+	u32 owner;
+	u32 reserved;
+	u64 next;
+}hm_shm_block;
+
+typedef struct hm_shm_seg_s {
+	u32 magic;
+	u32 version;
+	u64 size;
+	u32 nspans;
+	u32 first;
+	/* hm_pool_signature() of the creator, spans store class indices */
+	u32 table;
+	u32 reserved;
+	pthread_mutex_t lock;
+	hm_shm_slot slots[HM_SHM_SLOTS];
+	hm_shm_span spans[];
+}hm_shm_seg;
+
+/* per process view of a segment */
+typedef struct hm_shm_s {
+	hm_shm_seg* seg;
+	size_t size;
+	int fd;
+	u32 slot;
+	hm_lock lock;
+	u32 current[HM_CLASS_MAX];
+	hm_shm_ptr local[HM_CLASS_MAX];
+}hm_shm;
+
+static __inline void* hm_shm_addr(hm_shm* shm, hm_shm_ptr ptr)
+{
+	return ptr ? (char* )shm->seg+ptr : NULL;
+}
+
+static __inline hm_shm_ptr hm_shm_offset(hm_shm* shm, const void* addr)
+{
+	return addr ? (hm_shm_ptr)((const char* )addr-(const char* )shm->seg) : 0;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+hm_shm* hm_shm_create(const char* name, size_t size);
+hm_shm* hm_shm_open(const char* name);
+hm_shm* hm_shm_attach(int fd);
+void hm_shm_close(hm_shm* shm);
+int hm_shm_unlink(const char* name);
+
+hm_shm_ptr hm_shm_alloc(hm_shm* shm, size_t size);
+void hm_shm_free(hm_shm* shm, hm_shm_ptr ptr);
+int hm_shm_adopt(hm_shm* shm, hm_shm_ptr ptr);
+size_t hm_shm_usable_size(hm_shm* shm, hm_shm_ptr ptr);
+
+size_t hm_shm_recover(hm_shm* shm);
+size_t hm_shm_spans(hm_shm* shm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
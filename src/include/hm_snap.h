@@ -0,0 +1,65 @@
+#ifndef HM_SNAP_H
+#define HM_SNAP_H
+
+#include "hm_mgr.h"
+
+/*
+ * a heap built once, written to a file and mapped back by later runs with
+ * every block where it was. blocks come from a manager of their own whose
+ * chunks sit in one range, the range is the file. a snapshot mapped at
+ * another base gets the pointer fields registered with hm_snap_reloc()
+ * moved, anything else holding an address into it is the caller's.
+ */
+
+#define HM_SNAP_MAGIC	0x686d736eu
+#define HM_SNAP_VERSION	2
+
+/* hm_snap_load flags */
+#define HM_SNAP_COW		flag_bit(0)
+/* fail rather than relocate when the base is taken */
+#define HM_SNAP_FIXED	flag_bit(1)
+
+/* the first page of the file, the range follows it and the relocations the range */
+typedef struct hm_snap_head_s {
+	u32 magic;
+	u32 version;
+	u64 base;
+	u64 size;
+	/* offsets from base */
+	u64 root;
+	u64 relocs;
+	/* hm_pool_signature() of the builder, pools store class indices */
+	u32 table;
+	u32 reserved;
+}hm_snap_head;
+
+typedef struct hm_snap_s {
+	hm_mgr* mgr;
+	char* base;
+	size_t size;
+	void* root;
+	/* field offsets from base, a loaded snapshot has none */
+	u64* relocs;
+	size_t nrelocs;
+	size_t maxrelocs;
+}hm_snap;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+hm_snap* hm_snap_create(void* base, size_t size);
+void* hm_snap_alloc(hm_snap* snap, size_t size);
+int hm_snap_reloc(hm_snap* snap, void* field);
+void hm_snap_set_root(hm_snap* snap, void* root);
+int hm_snap_save(hm_snap* snap, const char* path);
+
+hm_snap* hm_snap_load(const char* path, u32 flags);
+void* hm_snap_root(hm_snap* snap);
+void hm_snap_close(hm_snap* snap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
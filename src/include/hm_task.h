@@ -1,33 +1,61 @@
 #ifndef RS_HM_TASK_H
 #define RS_HM_TASK_H
 
-typedef struct hm_task_s {
-	list list;
+#include "hm_mem.h"
+#include "hm_ebr.h"
+#include "hm_budget.h"
+
+struct hm_task_s {
+	hlist_node_t list;
 	hm_atom id;
 	hm_mem mem;
-}hm_task;
+	hm_bin bins[HM_CLASS_MAX];
+	hm_bin remote[HM_CLASS_MAX];
+	hm_ebr ebr;
+	hm_budget budget;
+};
 
 #define HM_TASK_MASK 0x3fful
 #define HM_TASK_MAX (HM_TASK_MASK+1)
 
 #define hm_task_head(tasks, hashcode) ((tasks)+((hashcode)&HM_TASK_MASK))
 
-/* for debugging */
-static __inline hm_task* hm_task_current() 
-{
-	return hm_task_search(hm_atom_current());
-}
+extern HM_TLS hm_task* hm_task_local;
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+int hm_task_initialize();
 int hm_task_register();
+int hm_task_unregister();
+int hm_task_reserve(const size_t* bytes, u32 flags);
+int hm_task_set_reserve(const size_t* bytes, u32 flags);
+int hm_task_rebind();
+int hm_task_set_budget(size_t soft, size_t hard, hm_budget_callback callback, void* arg);
+int hm_task_set_group(hm_group* group);
+s64 hm_task_usage();
+hm_task* hm_task_attach();
 hm_task* hm_task_search(hm_atom atom);
 
 #ifdef __cplusplus
 }
 #endif
 
-#endif
+/* for debugging */
+static __inline hm_task* hm_task_current()
+{
+	return hm_task_search(hm_atom_current());
+}
+
+/* the calling thread's task, registered on first use */
+static __inline hm_task* hm_task_self()
+{
+	hm_task* task = hm_task_local;
 
+	if(hm_likely(task))
+		return task;
+	return hm_task_attach();
+}
+
+#endif
@@ -3,5 +3,12 @@
 
 #include "hm_def.h"
 
-#endif
+typedef struct hm_pool_s hm_pool;
+typedef struct hm_chunk_s hm_chunk;
+typedef struct hm_mgr_s hm_mgr;
+typedef struct hm_mem_s hm_mem;
+typedef struct hm_task_s hm_task;
+typedef struct hm_ctx_s hm_ctx;
+typedef struct hm_group_s hm_group;
 
+#endif
@@ -0,0 +1,12 @@
+#ifndef HOTMEM_H
+#define HOTMEM_H
+
+#include "hm_mem.h"
+#include "hm_task.h"
+#include "hm_ebr.h"
+#include "hm_ctx.h"
+#include "hm_guard.h"
+#include "hm_budget.h"
+#include "hm_snap.h"
+
+#endif
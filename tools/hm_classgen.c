@@ -0,0 +1,249 @@
+/*
+ * size class table generator. reads a size histogram, "size count" per line
+ * as written by hm_pool_profile_dump(), or a trace with one size per line,
+ * and picks the classes that waste the least memory within a cap on their
+ * number. the output is a header for -DHM_CLASS_TABLE=..., which can also be
+ * loaded at startup through HOTMEM_CLASSES.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hotmem.h"
+
+#define HM_GEN_SLOTS (HM_SMALL_MAX/HM_ALIGN+1)
+#define HM_GEN_INF (~0ull)
+
+typedef struct hm_gen_s {
+	u64 counts[HM_GEN_SLOTS];
+	u64 requested;
+	u64 objects;
+	u64 large;
+}hm_gen;
+
+/* sizes above 1024 share lookup slots of 128 bytes, see hm_pool_index() */
+static u32 hm_gen_round(u64 size)
+{
+	if(size <= 1024)
+		return (u32)hm_align_up(size, HM_ALIGN);
+	return (u32)hm_align_up(size, 128);
+}
+
+static int hm_gen_read(hm_gen* gen, FILE* fp)
+{
+	unsigned long long size, count;
+	char line[256];
+	int n;
+
+	while(fgets(line, sizeof(line), fp)) {
+		if(line[0] == '#')
+			continue;
+		n = sscanf(line, "%llu %llu", &size, &count);
+		if(n < 1 || !size)
+			continue;
+		if(n == 1)
+			count = 1;
+
+		if(size > HM_SMALL_MAX) {
+			gen->large += count;
+			continue;
+		}
+		gen->counts[hm_gen_round(size)/HM_ALIGN] += count;
+		gen->requested += size*count;
+		gen->objects += count;
+	}
+
+	return ferror(fp) ? -1 : 0;
+}
+
+/* bytes handed out for the histogram by the table hm_pool is set up with */
+static u64 hm_gen_current(hm_gen* gen)
+{
+	u64 total = 0;
+	u32 slot;
+
+	for(slot = 1; slot < HM_GEN_SLOTS; slot ++) {
+		if(gen->counts[slot])
+			total += gen->counts[slot]*hm_pool_sizes[hm_pool_class((size_t)slot*HM_ALIGN)];
+	}
+	return total;
+}
+
+/*
+ * dynamic program over the observed sizes. the powers of two are always
+ * classes, so sizes missing from the profile never waste more than half.
+ */
+static u32 hm_gen_solve(hm_gen* gen, u32 cap, u32* table, u64* bytes)
+{
+	u32 *sizes, *lo, n, m, i, j, k, best, slot, last;
+	u64 *cnt, *f, cost, value;
+	int *from, *mandatory;
+
+	sizes = calloc(HM_GEN_SLOTS, sizeof(u32));
+	mandatory = calloc(HM_GEN_SLOTS, sizeof(int));
+	if(!sizes || !mandatory)
+		abort();
+	n = 0;
+	for(slot = 1; slot < HM_GEN_SLOTS; slot ++) {
+		k = slot*HM_ALIGN;
+		if(!gen->counts[slot] && (k&(k-1)))
+			continue;
+		sizes[n] = k;
+		mandatory[n ++] = !(k&(k-1));
+	}
+
+	cnt = calloc(n+1, sizeof(u64));
+	lo = calloc(n, sizeof(u32));
+	f = calloc((size_t)(cap+1)*n, sizeof(u64));
+	from = calloc((size_t)(cap+1)*n, sizeof(int));
+	if(!cnt || !lo || !f || !from)
+		abort();
+
+	/* prefix sums, cnt[j+1] covers sizes[0..j] */
+	last = 0;
+	for(j = 0; j < n; j ++) {
+		cnt[j+1] = cnt[j]+gen->counts[sizes[j]/HM_ALIGN];
+		/* a class may not span a mandatory size, lo is the first allowed start */
+		lo[j] = last;
+		if(mandatory[j])
+			last = j+1;
+	}
+
+	for(k = 0; k <= cap; k ++) {
+		for(j = 0; j < n; j ++)
+			f[(size_t)k*n+j] = HM_GEN_INF;
+	}
+	/* f[k][j], the least bytes with k classes covering sizes[0..j], the last one sizes[j] */
+	for(j = 0; j < n && !lo[j]; j ++)
+		f[n+j] = sizes[j]*cnt[j+1];
+	for(k = 2; k <= cap; k ++) {
+		for(j = 1; j < n; j ++) {
+			for(i = lo[j] ? lo[j]-1 : 0; i < j; i ++) {
+				value = f[(size_t)(k-1)*n+i];
+				if(value == HM_GEN_INF)
+					continue;
+				cost = value+sizes[j]*(cnt[j+1]-cnt[i+1]);
+				if(cost < f[(size_t)k*n+j]) {
+					f[(size_t)k*n+j] = cost;
+					from[(size_t)k*n+j] = (int)i;
+				}
+			}
+		}
+	}
+
+	best = 0;
+	for(k = 1; k <= cap; k ++) {
+		if(f[(size_t)k*n+n-1] != HM_GEN_INF && (!best || f[(size_t)k*n+n-1] < f[(size_t)best*n+n-1]))
+			best = k;
+	}
+
+	m = 0;
+	if(best) {
+		*bytes = f[(size_t)best*n+n-1];
+		for(j = n-1, k = best; k; k --) {
+			table[k-1] = sizes[j];
+			j = (u32)from[(size_t)k*n+j];
+		}
+		m = best;
+	}
+
+	free(from);
+	free(f);
+	free(lo);
+	free(cnt);
+	free(mandatory);
+	free(sizes);
+	return m;
+}
+
+static void hm_gen_write(FILE* out, const char* input, const u32* table, u32 count,
+	double waste, double current)
+{
+	u32 index;
+
+	fprintf(out, "/* generated by hm_classgen from %s, do not edit */\n", input);
+	fprintf(out, "/* %u classes, %.2f%% internal fragmentation, %.2f%% with the table it replaces */\n\n",
+		count, waste, current);
+	fprintf(out, "static const u32 hm_pool_table[] = {");
+	for(index = 0; index < count; index ++)
+		fprintf(out, "%s%u", index%8 ? ", " : index ? ",\n\t" : "\n\t", table[index]);
+	fprintf(out, "\n};\n");
+}
+
+static void hm_gen_usage()
+{
+	fprintf(stderr, "usage: hm_classgen [-n classes] [-o header] histogram\n");
+}
+
+int main(int argc, char** argv)
+{
+	const char *input, *output;
+	u32 table[HM_CLASS_MAX];
+	double waste, current;
+	hm_gen* gen;
+	u32 cap, count;
+	u64 bytes;
+	FILE *fp, *out;
+	int arg;
+
+	cap = 32;
+	input = output = NULL;
+	for(arg = 1; arg < argc; arg ++) {
+		if(!strcmp(argv[arg], "-n") && arg+1 < argc)
+			cap = (u32)atoi(argv[++ arg]);
+		else if(!strcmp(argv[arg], "-o") && arg+1 < argc)
+			output = argv[++ arg];
+		else if(argv[arg][0] == '-' && argv[arg][1]) {
+			hm_gen_usage();
+			return 2;
+		}
+		else
+			input = argv[arg];
+	}
+	if(!input || !cap || cap >= HM_CLASS_MAX) {
+		hm_gen_usage();
+		return 2;
+	}
+
+	gen = calloc(1, sizeof(hm_gen));
+	if(!gen)
+		return 1;
+	fp = strcmp(input, "-") ? fopen(input, "r") : stdin;
+	if(!fp || hm_gen_read(gen, fp)) {
+		fprintf(stderr, "hm_classgen: cannot read %s\n", input);
+		return 1;
+	}
+	if(fp != stdin)
+		fclose(fp);
+	if(!gen->objects) {
+		fprintf(stderr, "hm_classgen: no small sizes in %s\n", input);
+		return 1;
+	}
+
+	count = hm_gen_solve(gen, cap, table, &bytes);
+	if(!count) {
+		fprintf(stderr, "hm_classgen: %u classes cannot cover the powers of two up to %u\n",
+			cap, HM_SMALL_MAX);
+		return 1;
+	}
+
+	if(hm_pool_initialize())
+		return 1;
+	waste = 100.0*(double)(bytes-gen->requested)/(double)bytes;
+	bytes = hm_gen_current(gen);
+	current = 100.0*(double)(bytes-gen->requested)/(double)bytes;
+
+	out = output ? fopen(output, "w") : stdout;
+	if(!out) {
+		fprintf(stderr, "hm_classgen: cannot write %s\n", output);
+		return 1;
+	}
+	hm_gen_write(out, input, table, count, waste, current);
+	if(out != stdout && fclose(out))
+		return 1;
+
+	fprintf(stderr, "hm_classgen: %llu objects, %llu large, %u classes, waste %.2f%% (was %.2f%%)\n",
+		(unsigned long long)gen->objects, (unsigned long long)gen->large, count, waste, current);
+	free(gen);
+	return 0;
+}